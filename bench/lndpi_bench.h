@@ -0,0 +1,110 @@
+#ifndef LNDPI_BENCH_H
+#define LNDPI_BENCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if_arp.h>
+
+/* Size of one synthetic frame in a block */
+#define LNDPI_BENCH_FRAME_SIZE 128
+
+/* Offset of the first frame in a block */
+#define LNDPI_BENCH_BLOCK_HEADER_SIZE 64
+
+/**
+ *  Get monotonic time in nanoseconds
+ */
+static inline uint64_t lndpi_bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ *  Build a TPACKET_V3 block of Ethernet/IPv4 frames of random flows
+ *  Client 10.0.0.0/8 talks to server 192.168.0.1 on server_port; directions are random
+ *  Frames are stamped with the current wall clock time
+ *
+ *  @param  packets_num     number of frames
+ *  @param  flows_num       number of flows
+ *  @param  ip_protocol     IPPROTO_TCP or IPPROTO_UDP
+ *  @param  server_port     server port of all flows
+ *  @param  seed            seed of the flow and direction choice
+ *  @return pointer to a block to free() or NULL if memory is exhausted
+ */
+static inline struct tpacket_block_desc* lndpi_bench_block(
+    uint32_t packets_num,
+    uint32_t flows_num,
+    uint8_t ip_protocol,
+    uint16_t server_port,
+    uint32_t seed
+) {
+    uint8_t* block = (uint8_t*)calloc(1, LNDPI_BENCH_BLOCK_HEADER_SIZE + (size_t)packets_num * LNDPI_BENCH_FRAME_SIZE);
+
+    if (block == NULL)
+        return NULL;
+
+    struct tpacket_block_desc* desc = (struct tpacket_block_desc*)block;
+    struct timespec now;
+    uint32_t i;
+
+    desc->hdr.bh1.num_pkts = packets_num;
+    desc->hdr.bh1.offset_to_first_pkt = LNDPI_BENCH_BLOCK_HEADER_SIZE;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    srand(seed);
+
+    for (i = 0; i < packets_num; ++i)
+    {
+        struct tpacket3_hdr* pkt = (struct tpacket3_hdr*)
+            (block + LNDPI_BENCH_BLOCK_HEADER_SIZE + (size_t)i * LNDPI_BENCH_FRAME_SIZE);
+
+        uint32_t flow = (uint32_t)rand() % flows_num;
+        uint8_t to_server = rand() & 1;
+
+        pkt->tp_next_offset = LNDPI_BENCH_FRAME_SIZE;
+        pkt->tp_sec = now.tv_sec;
+        pkt->tp_nsec = now.tv_nsec;
+        struct sockaddr_ll* sll = (struct sockaddr_ll*)((uint8_t*)pkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        sll->sll_hatype = ARPHRD_ETHER;
+
+        pkt->tp_mac = TPACKET3_HDRLEN + 2;
+        pkt->tp_net = pkt->tp_mac + 14;
+        pkt->tp_snaplen = pkt->tp_len = 14 + 40;
+
+        uint8_t* eth = (uint8_t*)pkt + pkt->tp_mac;
+        eth[12] = 0x08;
+
+        uint8_t* ip = (uint8_t*)pkt + pkt->tp_net;
+        ip[0] = 0x45;
+        ip[3] = 40;
+        ip[8] = 64;
+        ip[9] = ip_protocol;
+
+        uint32_t client_addr = htonl(0x0a000000 + flow), server_addr = htonl(0xc0a80001);
+        uint16_t client_port = htons(1024 + flow % 60000), server_port_n = htons(server_port);
+
+        memcpy(ip + 12, to_server ? &client_addr : &server_addr, 4);
+        memcpy(ip + 16, to_server ? &server_addr : &client_addr, 4);
+        memcpy(ip + 20, to_server ? &client_port : &server_port_n, 2);
+        memcpy(ip + 22, to_server ? &server_port_n : &client_port, 2);
+
+        if (ip_protocol == IPPROTO_TCP)
+        {
+            ip[32] = 0x50;
+            ip[33] = 0x10;
+        } else
+            ip[25] = 20;
+    }
+
+    return desc;
+}
+
+#endif
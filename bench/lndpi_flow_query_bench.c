@@ -0,0 +1,218 @@
+/**
+ *  Flow query table benchmark
+ *  One writer publishes a flow on every simulated packet while reader threads look flows up
+ *  Reports reader latency percentiles and the retry rate, and checks that no reader ever
+ *  gets a torn copy: every published copy keeps an invariant over all of its fields
+ *
+ *  Usage: lndpi_flow_query_bench [readers_num [seconds [flows_num]]]
+ */
+#include "lndpi_bench.h"
+#include "lndpi_flow_query.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+/* Latency histogram resolution and range in nanoseconds */
+#define BENCH_LATENCY_BINS 100000
+
+/* Max number of reader threads */
+#define BENCH_MAX_READERS 64
+
+struct bench_reader
+{
+    pthread_t thread;
+    uint32_t seed;
+    uint64_t lookups;
+    uint64_t found;
+    uint64_t torn;
+    uint64_t* latency_bins;                 /* Lookups per nanosecond of latency; the last bin holds the rest */
+};
+
+static struct lndpi_flow_query_table s_table;
+static struct lndpi_packet_flow* s_flows;
+static uint32_t s_flows_num;
+static volatile int s_stop;
+
+/**
+ *  Set flow fields so that any copy of the flow mixing two publications breaks the invariant
+ */
+static void bench_flow_update(struct lndpi_packet_flow* flow, uint64_t version)
+{
+    flow->packets_num = version;
+    flow->bytes_num = version * 1500 + flow->id;
+    flow->last_packet_ms = version ^ flow->id;
+    flow->protocol.app_protocol = (uint16_t)version;
+    flow->protocol.master_protocol = (uint16_t)(version >> 16);
+    flow->protocol.category = (ndpi_protocol_category_t)(version & 0xff);
+}
+
+static uint8_t bench_info_consistent(const struct lndpi_flow_info* info, uint32_t id)
+{
+    uint64_t version = info->packets_num;
+
+    return info->id == id
+        && info->src_addr.s_addr == s_flows[id].src_addr.s_addr
+        && info->src_port == s_flows[id].src_port
+        && info->bytes_num == version * 1500 + id
+        && info->last_packet_ms == (version ^ id)
+        && info->app_protocol == (uint16_t)version
+        && info->master_protocol == (uint16_t)(version >> 16)
+        && info->category == (version & 0xff);
+}
+
+static void* bench_reader_run(void* parameter)
+{
+    struct bench_reader* reader = (struct bench_reader*)parameter;
+    struct lndpi_flow_info info;
+
+    while (!s_stop)
+    {
+        uint32_t id = (reader->seed = reader->seed * 1103515245 + 12345) % s_flows_num;
+        struct lndpi_packet_flow* flow = &s_flows[id];
+
+        uint64_t start_ns = lndpi_bench_now_ns();
+        uint8_t found = lndpi_flow_query_lookup(
+            &s_table,
+            flow->src_addr,
+            flow->dst_addr,
+            flow->src_port,
+            flow->dst_port,
+            flow->ip_protocol,
+            &info
+        );
+        uint64_t latency_ns = lndpi_bench_now_ns() - start_ns;
+
+        ++reader->latency_bins[latency_ns < BENCH_LATENCY_BINS ? latency_ns : BENCH_LATENCY_BINS - 1];
+        ++reader->lookups;
+
+        if (found)
+        {
+            ++reader->found;
+
+            if (!bench_info_consistent(&info, id))
+                ++reader->torn;
+        }
+    }
+
+    return NULL;
+}
+
+static uint64_t bench_percentile(const uint64_t* bins, uint64_t total, double fraction)
+{
+    uint64_t rank = (uint64_t)(total * fraction), seen = 0;
+    uint32_t i;
+
+    for (i = 0; i < BENCH_LATENCY_BINS; ++i)
+        if ((seen += bins[i]) > rank)
+            return i;
+
+    return BENCH_LATENCY_BINS - 1;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t readers_num = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 2;
+    double seconds = argc > 2 ? strtod(argv[2], NULL) : 2.0;
+    uint32_t i;
+
+    s_flows_num = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : 4096;
+
+    if (readers_num == 0 || readers_num > BENCH_MAX_READERS || s_flows_num == 0)
+    {
+        fprintf(stderr, "usage: %s [readers_num (1-%d) [seconds [flows_num]]]\n", argv[0], BENCH_MAX_READERS);
+
+        return 1;
+    }
+
+    if (lndpi_flow_query_init(&s_table, s_flows_num * 2) != LNDPI_OK
+        || (s_flows = (struct lndpi_packet_flow*)calloc(s_flows_num, sizeof(struct lndpi_packet_flow))) == NULL)
+        return 1;
+
+    for (i = 0; i < s_flows_num; ++i)
+    {
+        struct lndpi_packet_flow* flow = &s_flows[i];
+
+        flow->id = i;
+        flow->src_addr.s_addr = htonl(0x0a000000 + i);
+        flow->dst_addr.s_addr = htonl(0xc0a80001);
+        flow->src_port = (uint16_t)(1024 + i % 60000);
+        flow->dst_port = 443;
+        flow->ip_protocol = IPPROTO_TCP;
+        flow->hash = lndpi_packet_flow_hash(flow->src_addr, flow->dst_addr, flow->src_port, flow->dst_port);
+
+        bench_flow_update(flow, 0);
+        lndpi_flow_query_publish(&s_table, flow);
+    }
+
+    struct bench_reader readers[BENCH_MAX_READERS];
+
+    for (i = 0; i < readers_num; ++i)
+    {
+        readers[i].seed = i + 1;
+        readers[i].lookups = readers[i].found = readers[i].torn = 0;
+
+        if ((readers[i].latency_bins = (uint64_t*)calloc(BENCH_LATENCY_BINS, sizeof(uint64_t))) == NULL
+            || pthread_create(&readers[i].thread, NULL, bench_reader_run, &readers[i]) != 0)
+            return 1;
+    }
+
+    /* Writer: every simulated packet updates and publishes its flow */
+    uint64_t publications = 0, deadline_ns = lndpi_bench_now_ns() + (uint64_t)(seconds * 1e9);
+    uint32_t seed = 0;
+
+    while ((publications & 0xfff) != 0 || lndpi_bench_now_ns() < deadline_ns)
+    {
+        struct lndpi_packet_flow* flow = &s_flows[(seed = seed * 1103515245 + 12345) % s_flows_num];
+
+        bench_flow_update(flow, flow->packets_num + 1);
+        lndpi_flow_query_publish(&s_table, flow);
+
+        ++publications;
+    }
+
+    s_stop = 1;
+
+    uint64_t lookups = 0, found = 0, torn = 0;
+    uint64_t* bins = (uint64_t*)calloc(BENCH_LATENCY_BINS, sizeof(uint64_t));
+    uint32_t j;
+
+    if (bins == NULL)
+        return 1;
+
+    for (i = 0; i < readers_num; ++i)
+    {
+        pthread_join(readers[i].thread, NULL);
+
+        lookups += readers[i].lookups;
+        found += readers[i].found;
+        torn += readers[i].torn;
+
+        for (j = 0; j < BENCH_LATENCY_BINS; ++j)
+            bins[j] += readers[i].latency_bins[j];
+
+        free(readers[i].latency_bins);
+    }
+
+    printf("writer: %lu publications (%.1f M/s), %lu overflows\n",
+        (unsigned long)publications,
+        publications / seconds / 1e6,
+        (unsigned long)s_table.overflows);
+    printf("readers: %u threads, %lu lookups, %lu found\n",
+        readers_num,
+        (unsigned long)lookups,
+        (unsigned long)found);
+    printf("lookup latency: p50 %lu ns, p99 %lu ns, p99.9 %lu ns\n",
+        (unsigned long)bench_percentile(bins, lookups, 0.5),
+        (unsigned long)bench_percentile(bins, lookups, 0.99),
+        (unsigned long)bench_percentile(bins, lookups, 0.999));
+    printf("retries: %lu (%.4f%% of lookups)\n",
+        (unsigned long)s_table.read_retries,
+        lookups > 0 ? 100.0 * s_table.read_retries / lookups : 0.0);
+    printf("torn reads: %lu\n", (unsigned long)torn);
+
+    free(bins);
+    free(s_flows);
+    lndpi_flow_query_exit(&s_table);
+
+    return torn != 0;
+}
@@ -0,0 +1,95 @@
+/**
+ *  Housekeeping interval benchmark
+ *  Processes packets of flows which stay unclassified, so the packet buffer keeps growing,
+ *  and reports the processing time for each housekeeping interval given in packets
+ *
+ *  Usage: lndpi_housekeeping_bench [packets_num [interval ...]]
+ */
+#include "lndpi_bench.h"
+#include "lndpi_packet.h"
+
+#include <stdio.h>
+
+/* Number of frames in one block */
+#define BENCH_BLOCK_SIZE 4096
+
+/* Number of flows in the traffic */
+#define BENCH_FLOWS_NUM 20000
+
+static enum lndpi_error bench_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet_struct,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+) {
+    return LNDPI_OK;
+}
+
+static int bench_run(uint32_t packets_num, uint32_t interval, struct tpacket_block_desc* block)
+{
+    enum lndpi_error error;
+    char error_str[128];
+
+    lndpi_set_housekeeping_interval(interval, 0);
+
+    if ((error = lndpi_packet_lib_init(BENCH_FLOWS_NUM * 2, 1000000, packets_num + BENCH_BLOCK_SIZE, 600000)) != LNDPI_OK)
+    {
+        fprintf(stderr, "init: %s\n", lndpi_error_to_string(error, error_str));
+
+        return 1;
+    }
+
+    lndpi_set_packet_callback_function(bench_packet_callback, NULL);
+
+    uint64_t start_ns = lndpi_bench_now_ns();
+    uint32_t processed;
+
+    for (processed = 0; processed < packets_num; processed += BENCH_BLOCK_SIZE)
+        if ((error = lndpi_process_block(block)) != LNDPI_OK)
+        {
+            fprintf(stderr, "process: %s\n", lndpi_error_to_string(error, error_str));
+
+            break;
+        }
+
+    uint64_t elapsed_ns = lndpi_bench_now_ns() - start_ns;
+
+    struct lndpi_packet_lib_stats stats;
+    lndpi_get_stats(&stats);
+
+    printf("interval %6u packets: %8.3f s, %8.1f ns/packet, %lu housekeeping runs\n",
+        interval,
+        elapsed_ns / 1e9,
+        (double)elapsed_ns / processed,
+        (unsigned long)stats.housekeeping_runs);
+
+    lndpi_packet_lib_finalize();
+    lndpi_packet_lib_exit();
+
+    return error != LNDPI_OK;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t packets_num = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 400000;
+    static const uint32_t default_intervals[] = { 1, 64, 4096 };
+
+    struct tpacket_block_desc* block;
+
+    if ((block = lndpi_bench_block(BENCH_BLOCK_SIZE, BENCH_FLOWS_NUM, IPPROTO_UDP, 5000, 1)) == NULL)
+        return 1;
+
+    int i, failed = 0;
+
+    if (argc > 2)
+        for (i = 2; i < argc; ++i)
+            failed |= bench_run(packets_num, (uint32_t)strtoul(argv[i], NULL, 10), block);
+    else
+        for (i = 0; i < (int)(sizeof(default_intervals) / sizeof(default_intervals[0])); ++i)
+            failed |= bench_run(packets_num, default_intervals[i], block);
+
+    free(block);
+
+    return failed;
+}
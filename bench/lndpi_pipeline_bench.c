@@ -0,0 +1,104 @@
+/**
+ *  Processing pipeline benchmark
+ *  Processes blocks of synthetic packets and reports the cost per packet
+ *  `make bench` builds it with dynamic callbacks and with the LNDPI_STATIC_* / LNDPI_NO_*
+ *  options (see Makefile) so that the variants can be compared on the same traffic
+ *
+ *  Usage: lndpi_pipeline_bench [packets_num [flows_num]]
+ */
+#include "lndpi_bench.h"
+#include "lndpi_packet.h"
+
+#include <stdio.h>
+
+/* Number of frames in one block */
+#define BENCH_BLOCK_SIZE 4096
+
+static uint64_t s_callbacks;
+
+/**
+ *  Packet callback; not static so that it can be bound with LNDPI_STATIC_PACKET_CALLBACK
+ */
+enum lndpi_error bench_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet_struct,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+) {
+    s_callbacks += packet_struct->length;
+
+    return LNDPI_OK;
+}
+
+static const char* bench_variant(void)
+{
+#if defined(LNDPI_STATIC_PACKET_CALLBACK) && defined(LNDPI_NO_BUFFERING)
+    return "static, unbuffered";
+#elif defined(LNDPI_STATIC_PACKET_CALLBACK)
+    return "static";
+#elif defined(LNDPI_NO_BUFFERING)
+    return "dynamic, unbuffered";
+#else
+    return "dynamic";
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t packets_num = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 4000000;
+    uint32_t flows_num = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 10000;
+
+    enum lndpi_error error;
+    char error_str[128];
+
+    struct tpacket_block_desc* tcp_block, * udp_block;
+
+    if ((tcp_block = lndpi_bench_block(BENCH_BLOCK_SIZE, flows_num, IPPROTO_TCP, 80, 1)) == NULL
+        || (udp_block = lndpi_bench_block(BENCH_BLOCK_SIZE, flows_num, IPPROTO_UDP, 53, 2)) == NULL)
+        return 1;
+
+    /* Flows which stay unclassified must not stop the pipeline once the buffer is full */
+    lndpi_set_packet_buffer_policy(LNDPI_PACKET_BUFFER_POLICY_GIVEUP_OLDEST);
+    lndpi_set_housekeeping_interval(BENCH_BLOCK_SIZE, 0);
+
+    if ((error = lndpi_packet_lib_init(flows_num * 4, 8, BENCH_BLOCK_SIZE * 4, 60000)) != LNDPI_OK)
+    {
+        fprintf(stderr, "init: %s\n", lndpi_error_to_string(error, error_str));
+
+        return 1;
+    }
+
+    lndpi_set_packet_callback_function(bench_packet_callback, NULL);
+
+    uint64_t start_ns = lndpi_bench_now_ns();
+    uint32_t processed;
+
+    for (processed = 0; processed < packets_num; processed += BENCH_BLOCK_SIZE)
+        if ((error = lndpi_process_block(processed / BENCH_BLOCK_SIZE % 2 ? udp_block : tcp_block)) != LNDPI_OK)
+        {
+            fprintf(stderr, "process: %s\n", lndpi_error_to_string(error, error_str));
+
+            break;
+        }
+
+    lndpi_poll();
+
+    uint64_t elapsed_ns = lndpi_bench_now_ns() - start_ns;
+
+    printf("%-20s %u packets: %8.3f s, %7.1f ns/packet, %6.2f Mpps (%lu bytes emitted)\n",
+        bench_variant(),
+        processed,
+        elapsed_ns / 1e9,
+        (double)elapsed_ns / processed,
+        processed * 1e3 / elapsed_ns,
+        (unsigned long)s_callbacks);
+
+    lndpi_packet_lib_finalize();
+    lndpi_packet_lib_exit();
+
+    free(tcp_block);
+    free(udp_block);
+
+    return error != LNDPI_OK;
+}
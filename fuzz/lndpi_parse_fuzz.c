@@ -0,0 +1,235 @@
+/**
+ *  Fuzz target for frame parsing
+ *  Builds a TPACKET_V3 frame from arbitrary bytes and runs it through lndpi_process_packet()
+ *  The frame buffer ends exactly at tp_mac + tp_snaplen, so AddressSanitizer reports any read
+ *  past the captured bytes
+ *
+ *  Input layout:
+ *      byte 0          tp_status flags: bit 0 sets TP_STATUS_VLAN_VALID, bit 1 sets TP_STATUS_VLAN_TPID_VALID;
+ *                      bit 2 sets sll_hatype to ARPHRD_ETHER instead of ARPHRD_NONE
+ *      bytes 1-2       signed offset of tp_net from tp_mac
+ *      bytes 3-4       tp_snaplen; clamped to the number of frame bytes
+ *      bytes 5-6       hv1.tp_vlan_tci
+ *      bytes 7-        frame starting at L2 header
+ *
+ *  Built with -DLNDPI_FUZZ_STANDALONE, the target replays given files or runs random inputs
+ *  for toolchains without libFuzzer
+ */
+#include "lndpi_packet.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <net/if_arp.h>
+
+/* Number of bytes before the frame in an input */
+#define FUZZ_HEADER_SIZE 7
+
+static enum lndpi_error fuzz_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet_struct,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+) {
+    return LNDPI_OK;
+}
+
+static void fuzz_init(void)
+{
+    static int initialized;
+
+    if (initialized)
+        return;
+
+    initialized = 1;
+
+    /* Keep memory bounded however many flows the inputs create */
+    lndpi_set_packet_buffer_policy(LNDPI_PACKET_BUFFER_POLICY_GIVEUP_OLDEST);
+    lndpi_set_flow_buffer_policy(LNDPI_FLOW_BUFFER_POLICY_EVICT);
+    lndpi_set_ip_fragments(256, 30000, 65535);
+
+    if (lndpi_packet_lib_init(4096, 8, 4096, 60000) != LNDPI_OK)
+        abort();
+
+    lndpi_set_packet_callback_function(fuzz_packet_callback, NULL);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size < FUZZ_HEADER_SIZE)
+        return 0;
+
+    fuzz_init();
+
+    size_t frame_size = size - FUZZ_HEADER_SIZE;
+    uint32_t mac = TPACKET3_HDRLEN;
+    uint32_t snaplen = (uint32_t)(data[3] | data[4] << 8);
+    int16_t net_offset = (int16_t)(data[1] | data[2] << 8);
+    int32_t net = (int32_t)mac + net_offset;
+
+    if (snaplen > frame_size)
+        snaplen = (uint32_t)frame_size;
+
+    /* Only captured bytes are allocated */
+    uint8_t* buffer = (uint8_t*)malloc(mac + snaplen);
+
+    if (buffer == NULL)
+        return 0;
+
+    struct tpacket3_hdr* pkt = (struct tpacket3_hdr*)buffer;
+
+    struct sockaddr_ll* sll = (struct sockaddr_ll*)(buffer + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+    memset(buffer, 0, mac);
+    memcpy(buffer + mac, data + FUZZ_HEADER_SIZE, snaplen);
+
+    sll->sll_hatype = data[0] & 4 ? ARPHRD_ETHER : ARPHRD_NONE;
+
+    pkt->tp_status = TP_STATUS_USER
+        | (data[0] & 1 ? TP_STATUS_VLAN_VALID : 0)
+        | (data[0] & 2 ? TP_STATUS_VLAN_TPID_VALID : 0);
+    pkt->hv1.tp_vlan_tci = (uint16_t)(data[5] | data[6] << 8);
+    pkt->tp_mac = (uint16_t)mac;
+    pkt->tp_net = (uint16_t)(net < 0 ? 0 : net > UINT16_MAX ? UINT16_MAX : net);
+    pkt->tp_snaplen = snaplen;
+    pkt->tp_len = (uint32_t)frame_size;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    pkt->tp_sec = now.tv_sec;
+    pkt->tp_nsec = now.tv_nsec;
+
+    lndpi_process_packet(pkt);
+
+    free(buffer);
+
+    return 0;
+}
+
+#ifdef LNDPI_FUZZ_STANDALONE
+
+#include <stdio.h>
+
+/* Max size of a random input */
+#define FUZZ_MAX_RANDOM_SIZE 256
+
+/**
+ *  Make a random input which is likely to get past the first checks:
+ *  mostly Ethernet frames with VLAN tags and IPv4 headers with random fields
+ */
+static size_t fuzz_random_input(uint8_t* input)
+{
+    size_t size = FUZZ_HEADER_SIZE + (size_t)rand() % (FUZZ_MAX_RANDOM_SIZE - FUZZ_HEADER_SIZE), i;
+
+    for (i = 0; i < size; ++i)
+        input[i] = (uint8_t)rand();
+
+    uint8_t* frame = input + FUZZ_HEADER_SIZE;
+    size_t frame_size = size - FUZZ_HEADER_SIZE, offset = 12;
+
+    if (rand() % 4 != 0)
+    {
+        /* Ethernet link with tp_net right after the Ethernet header */
+        input[0] |= 4;
+        input[1] = 14;
+        input[2] = 0;
+
+        /* Random chain of VLAN tags */
+        while (offset + 4 <= frame_size && rand() % 3 == 0)
+        {
+            static const uint16_t tpids[] = { 0x8100, 0x88a8, 0x9100 };
+            uint16_t tpid = tpids[rand() % 3];
+
+            frame[offset] = tpid >> 8;
+            frame[offset + 1] = tpid & 0xff;
+            offset += 4;
+        }
+
+        if (offset + 2 <= frame_size && rand() % 8 != 0)
+        {
+            frame[offset] = 0x08;
+            frame[offset + 1] = 0x00;
+        }
+
+        uint8_t* ip = frame + offset + 2;
+        size_t ip_size = offset + 2 < frame_size ? frame_size - offset - 2 : 0;
+
+        /* IPv4 header with a mostly plausible length, no fragment offset and TCP or UDP */
+        if (ip_size >= 1 && rand() % 8 != 0)
+            ip[0] = 0x40 | (rand() % 2 ? 5 + rand() % 3 : ip[0] & 0x0f);
+
+        if (ip_size >= 4 && rand() % 2 == 0)
+        {
+            uint16_t total_length = (uint16_t)(ip_size + rand() % 9 - 4);
+
+            ip[2] = total_length >> 8;
+            ip[3] = total_length & 0xff;
+        }
+
+        if (ip_size >= 8 && rand() % 2 == 0)
+        {
+            ip[6] &= 0x20;
+            ip[7] = 0;
+        }
+
+        if (ip_size >= 10 && rand() % 2 == 0)
+            ip[9] = rand() % 2 ? 6 : 17;
+    }
+
+    if (rand() % 2 == 0)
+    {
+        /* Make snaplen cover the whole frame */
+        input[3] = 0xff;
+        input[4] = 0xff;
+    }
+
+    return size;
+}
+
+int main(int argc, char** argv)
+{
+    int i;
+
+    if (argc > 1)
+    {
+        for (i = 1; i < argc; ++i)
+        {
+            FILE* file = fopen(argv[i], "rb");
+            uint8_t input[65536];
+
+            if (file == NULL)
+            {
+                perror(argv[i]);
+
+                return 1;
+            }
+
+            size_t size = fread(input, 1, sizeof(input), file);
+
+            fclose(file);
+
+            LLVMFuzzerTestOneInput(input, size);
+        }
+
+        return 0;
+    }
+
+    const char* runs_env = getenv("LNDPI_FUZZ_RUNS");
+    long runs = runs_env != NULL ? atol(runs_env) : 1000000, run;
+    uint8_t input[FUZZ_MAX_RANDOM_SIZE];
+
+    srand(1);
+
+    for (run = 0; run < runs; ++run)
+        LLVMFuzzerTestOneInput(input, fuzz_random_input(input));
+
+    printf("%ld random inputs processed\n", runs);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef LNDPI_COLUMNAR_SINK_H
+#define LNDPI_COLUMNAR_SINK_H
+
+#include <stdint.h>
+
+#include "lndpi_packet_flow.h"
+#include "lndpi_errors.h"
+
+/* Number of records in one columnar batch */
+#define LNDPI_COLUMNAR_BATCH_ROWS 8192
+
+/* Number of batches which can be filled or waiting for the writer thread */
+#define LNDPI_COLUMNAR_BATCHES 4
+
+/**
+ *  Output sink which writes records in columnar batches
+ *  Files are in Arrow IPC streaming format and are written by a background thread
+ *  Columns: flow_id, time, src_addr, dst_addr, src_port, dst_port, length, ip_protocol,
+ *  master_protocol, app_protocol, category, guessed
+ *  Protocol columns are dictionary encoded protocol names
+ *  Files can be checked with pyarrow, a development dependency only:
+ *  pyarrow.ipc.open_stream(path).read_all().validate(full=True)
+ */
+struct lndpi_columnar_sink;
+
+/**
+ *  Open a columnar sink and start its writer thread
+ *  Files are named <path_prefix>-<timestamp ms>-<index>.arrows
+ *  A new file is started when the current one reaches rotate_bytes or is older than rotate_ms
+ *
+ *  @param  sink            buffer to store pointer to a new sink
+ *  @param  path_prefix     prefix of output file paths
+ *  @param  rotate_bytes    max size of a file in bytes; 0 disables size based rotation
+ *  @param  rotate_ms       max age of a file in milliseconds; 0 disables time based rotation
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_columnar_sink_open(
+    struct lndpi_columnar_sink** sink,
+    const char* path_prefix,
+    uint64_t rotate_bytes,
+    uint64_t rotate_ms
+);
+
+/**
+ *  Pass a partially filled batch to the writer thread
+ *
+ *  @param  sink            pointer to a sink
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_columnar_sink_flush(struct lndpi_columnar_sink* sink);
+
+/**
+ *  Write remaining records, stop the writer thread and free a sink
+ *
+ *  @param  sink            pointer to a sink
+ *  @return LNDPI_OK on a successful run and the first writer error otherwise
+ */
+enum lndpi_error lndpi_columnar_sink_close(struct lndpi_columnar_sink* sink);
+
+/**
+ *  Packet callback function which appends packet records to a columnar sink
+ *  Blocks while all batches are waiting for the writer thread
+ *
+ *  @param  ndpi_struct             pointer to an nDPI detection module struct
+ *  @param  packet                  pointer to a packet struct
+ *  @param  timeout_ms              timeout in milliseconds for a flow
+ *  @param  max_packets_to_process  max number of packets to process without knowing protocol before give up
+ *  @param  parameter               pointer to a columnar sink
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_columnar_sink_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+);
+
+/**
+ *  Flow callback function which appends flow records to a columnar sink
+ *  Flow records have zero length and the timestamp of the flow's last packet
+ *
+ *  @param  ndpi_struct     pointer to an nDPI detection module struct
+ *  @param  flow            pointer to a flow
+ *  @param  parameter       pointer to a columnar sink
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_columnar_sink_flow_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow,
+    void* parameter
+);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef LNDPI_ENDPOINT_CACHE_H
+#define LNDPI_ENDPOINT_CACHE_H
+
+#include <stdint.h>
+
+#include "lndpi_packet_flow.h"
+#include "lndpi_errors.h"
+
+/* Number of entries in one set of an endpoint cache */
+#define LNDPI_ENDPOINT_CACHE_WAYS 4
+
+/**
+ *  Endpoint cache entry
+ */
+struct lndpi_endpoint_cache_entry
+{
+    uint64_t inserted_ms;                   /* Timestamp of the verdict */
+    struct in_addr addr;                    /* Server IP address */
+    uint16_t port;                          /* Server port */
+    uint8_t ip_protocol;                    /* Protocol ID from IP header */
+    uint8_t valid;                          /* 1 if entry is used; 0 otherwise */
+    ndpi_protocol protocol;                 /* Protocol detected by nDPI */
+};
+
+/**
+ *  Set associative cache of protocols detected for server endpoints
+ */
+struct lndpi_endpoint_cache
+{
+    struct lndpi_endpoint_cache_entry* entries; /* Sets of LNDPI_ENDPOINT_CACHE_WAYS entries */
+    uint32_t sets_mask;                         /* Number of sets minus one */
+    uint64_t ttl_ms;                            /* Time to live of an entry in milliseconds */
+};
+
+/**
+ *  Allocate endpoint cache
+ *  Number of entries is rounded up to a power of two
+ *
+ *  @param  cache           pointer to an endpoint cache
+ *  @param  size            max number of entries
+ *  @param  ttl_ms          time to live of an entry in milliseconds
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_endpoint_cache_init(
+    struct lndpi_endpoint_cache* cache,
+    uint32_t size,
+    uint64_t ttl_ms
+);
+
+/**
+ *  Free endpoint cache
+ *
+ *  @param  cache           pointer to an endpoint cache
+ */
+void lndpi_endpoint_cache_exit(struct lndpi_endpoint_cache* cache);
+
+/**
+ *  Find a protocol detected for a server endpoint
+ *
+ *  @param  cache           pointer to an endpoint cache
+ *  @param  addr            server IP address
+ *  @param  port            server port
+ *  @param  ip_protocol     protocol ID from IP header
+ *  @param  now_ms          current timestamp in milliseconds
+ *  @param  protocol        buffer to store found protocol
+ *  @return 1 if an entry which is not expired was found; 0 otherwise
+ */
+uint8_t lndpi_endpoint_cache_find(
+    struct lndpi_endpoint_cache* cache,
+    struct in_addr addr,
+    uint16_t port,
+    uint8_t ip_protocol,
+    uint64_t now_ms,
+    ndpi_protocol* protocol
+);
+
+/**
+ *  Put a protocol detected for a server endpoint into a cache
+ *  The oldest entry of the set is replaced if there is no free one
+ *
+ *  @param  cache           pointer to an endpoint cache
+ *  @param  addr            server IP address
+ *  @param  port            server port
+ *  @param  ip_protocol     protocol ID from IP header
+ *  @param  now_ms          current timestamp in milliseconds
+ *  @param  protocol        detected protocol
+ */
+void lndpi_endpoint_cache_put(
+    struct lndpi_endpoint_cache* cache,
+    struct in_addr addr,
+    uint16_t port,
+    uint8_t ip_protocol,
+    uint64_t now_ms,
+    ndpi_protocol protocol
+);
+
+#endif
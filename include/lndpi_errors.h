@@ -13,7 +13,19 @@ enum lndpi_error
     LNDPI_CANT_OPEN_LOG_FILE,
     LNDPI_CANT_WRITE_TO_LOG_FILE,
     LNDPI_NDPI_MODULE_INIT_ERROR,
-    LNDPI_IPV6_NOT_SUPPORTED
+    LNDPI_IPV6_NOT_SUPPORTED,
+    LNDPI_CANT_OPEN_SNAPSHOT_FILE,
+    LNDPI_CANT_WRITE_TO_SNAPSHOT_FILE,
+    LNDPI_INVALID_SNAPSHOT_FILE,
+    LNDPI_CANT_LOAD_PROTOCOLS_FILE,
+    LNDPI_CANT_LOAD_CATEGORIES_FILE,
+    LNDPI_CANT_BIND_NUMA_NODE,
+    LNDPI_CANT_OPEN_RESULT_RING,
+    LNDPI_INVALID_RESULT_RING,
+    LNDPI_CANT_OPEN_OUTPUT_FILE,
+    LNDPI_CANT_WRITE_TO_OUTPUT_FILE,
+    LNDPI_MALFORMED_PACKET,
+    LNDPI_NON_IP_PACKET
 };
 
 /**
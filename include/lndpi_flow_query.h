@@ -0,0 +1,137 @@
+#ifndef LNDPI_FLOW_QUERY_H
+#define LNDPI_FLOW_QUERY_H
+
+#include <stdint.h>
+
+#include "lndpi_packet_flow.h"
+#include "lndpi_errors.h"
+
+/* Number of flows in one bucket of a flow query table */
+#define LNDPI_FLOW_QUERY_WAYS 4
+
+/* Ratio of table entries to max published flows */
+#define LNDPI_FLOW_QUERY_HEADROOM 2
+
+/**
+ *  Copy of flow state which is readable by any thread
+ */
+struct lndpi_flow_info
+{
+    uint32_t id;                            /* ID of the flow */
+    struct in_addr src_addr;                /* Formal source IP address */
+    struct in_addr dst_addr;                /* Formal destination IP address */
+    uint16_t src_port;                      /* Formal source port */
+    uint16_t dst_port;                      /* Formal destination port */
+    uint16_t master_protocol;               /* Master protocol ID detected by nDPI */
+    uint16_t app_protocol;                  /* Application protocol ID detected by nDPI */
+    uint32_t category;                      /* Protocol category ID */
+    uint8_t ip_protocol;                    /* Protocol ID from IP header */
+    uint8_t detection_finished;             /* 1 if protocol is final; 0 otherwise */
+    uint8_t protocol_was_guessed;           /* 1 if protocol was guessed after giving up; 0 otherwise */
+    uint8_t tcp_state;                      /* LNDPI_TCP_* flags seen in the flow */
+    uint64_t packets_num;                   /* Number of packets of the flow */
+    uint64_t bytes_num;                     /* Number of IP bytes of the flow */
+    uint64_t last_packet_ms;                /* Timestamp of the flow's last packet */
+};
+
+/**
+ *  Bucket of a flow query table guarded by a sequence lock
+ *  Sequence number is odd while the detection thread updates the bucket
+ */
+struct lndpi_flow_query_bucket
+{
+    uint32_t seq;                                           /* Sequence lock */
+    uint8_t used[LNDPI_FLOW_QUERY_WAYS];                    /* 1 if an entry holds a flow; 0 otherwise */
+    struct lndpi_flow_info flows[LNDPI_FLOW_QUERY_WAYS];    /* Published flows */
+} __attribute__((aligned(64)));
+
+/**
+ *  Set associative table of flows published by the detection thread
+ *  A flow whose bucket is full goes to the neighbour bucket (index ^ 1)
+ *  The detection thread is the only writer and never waits; readers copy a bucket
+ *  and retry if it was changed meanwhile
+ *  Buckets are never freed while the table exists, so readers never touch freed memory
+ */
+struct lndpi_flow_query_table
+{
+    struct lndpi_flow_query_bucket* buckets;    /* Buckets; NULL if the table is not allocated */
+    uint32_t buckets_mask;                      /* Number of buckets minus one */
+    uint64_t overflows;                         /* Flows not published because their bucket and its neighbour were full */
+    uint64_t read_retries;                      /* Reader waits and copies retried because a bucket was being updated */
+};
+
+/**
+ *  Allocate flow query table
+ *  Table has LNDPI_FLOW_QUERY_HEADROOM entries per flow; number of buckets is rounded up to a power of two
+ *
+ *  @param  table           pointer to a flow query table
+ *  @param  size            max number of published flows
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_flow_query_init(struct lndpi_flow_query_table* table, uint32_t size);
+
+/**
+ *  Free flow query table
+ *  No reader may use the table at this point
+ *
+ *  @param  table           pointer to a flow query table
+ */
+void lndpi_flow_query_exit(struct lndpi_flow_query_table* table);
+
+/**
+ *  Publish the current state of a flow
+ *  Must be called by the detection thread only
+ *
+ *  @param  table           pointer to a flow query table
+ *  @param  flow            pointer to a flow
+ */
+void lndpi_flow_query_publish(struct lndpi_flow_query_table* table, struct lndpi_packet_flow* flow);
+
+/**
+ *  Remove a published flow
+ *  Must be called by the detection thread only
+ *
+ *  @param  flow            pointer to a flow
+ */
+void lndpi_flow_query_remove(struct lndpi_packet_flow* flow);
+
+/**
+ *  Find a flow by addresses in any direction
+ *  Safe to call from any thread
+ *
+ *  @param  table           pointer to a flow query table
+ *  @param  src_addr        source IP address
+ *  @param  dst_addr        destination IP address
+ *  @param  src_port        source port
+ *  @param  dst_port        destination port
+ *  @param  ip_protocol     protocol ID from IP header
+ *  @param  info            buffer to store a copy of the flow
+ *  @return 1 if the flow was found; 0 otherwise
+ */
+uint8_t lndpi_flow_query_lookup(
+    struct lndpi_flow_query_table* table,
+    struct in_addr src_addr,
+    struct in_addr dst_addr,
+    uint16_t src_port,
+    uint16_t dst_port,
+    uint8_t ip_protocol,
+    struct lndpi_flow_info* info
+);
+
+/**
+ *  Copy published flows
+ *  Safe to call from any thread
+ *  Each bucket is copied consistently; flows of different buckets may be copied at different moments
+ *
+ *  @param  table           pointer to a flow query table
+ *  @param  infos           buffer to store copies of flows
+ *  @param  max_infos       max number of flows to copy
+ *  @return number of copied flows
+ */
+uint32_t lndpi_flow_query_snapshot(
+    struct lndpi_flow_query_table* table,
+    struct lndpi_flow_info* infos,
+    uint32_t max_infos
+);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef LNDPI_FLOW_SNAPSHOT_H
+#define LNDPI_FLOW_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "lndpi_packet_buffers.h"
+#include "lndpi_errors.h"
+
+/* Magic number at the begining of a snapshot file */
+#define LNDPI_FLOW_SNAPSHOT_MAGIC 0x534e444cu
+
+/* Version of the snapshot file layout */
+#define LNDPI_FLOW_SNAPSHOT_VERSION 2
+
+/**
+ *  Snapshot file header
+ *  It is followed by records_number records of record_size bytes
+ */
+struct lndpi_flow_snapshot_header
+{
+    uint32_t magic;                         /* LNDPI_FLOW_SNAPSHOT_MAGIC */
+    uint32_t version;                       /* LNDPI_FLOW_SNAPSHOT_VERSION */
+    uint32_t record_size;                   /* Size of one record */
+    uint32_t records_number;                /* Number of records in the file */
+};
+
+/**
+ *  Snapshot record describing one flow
+ *  Addresses and ports are stored as in struct lndpi_packet_flow
+ */
+struct lndpi_flow_snapshot_record
+{
+    uint64_t last_packet_ms;                /* Timestamp for the last packet arrived */
+    uint32_t src_addr;                      /* Formal source IP address */
+    uint32_t dst_addr;                      /* Formal destination IP address */
+    uint16_t src_port;                      /* Formal source port */
+    uint16_t dst_port;                      /* Formal destination port */
+    uint16_t master_protocol;               /* Master protocol detected by nDPI */
+    uint16_t app_protocol;                  /* Application protocol detected by nDPI */
+    uint32_t category;                      /* Protocol category detected by nDPI */
+    uint32_t processed_packets_num;         /* Number of processed packets to detect protocol */
+    uint8_t ip_protocol;                    /* Protocol ID from IP header */
+    uint8_t protocol_was_guessed;           /* 1 if protocol was guessed after giving up; 0 otherwise */
+    uint8_t detection_given_up;             /* 1 if detection was given up; 0 otherwise */
+    uint8_t tcp_state;                      /* LNDPI_TCP_* flags seen in the flow */
+    uint32_t reserved;                      /* Padding */
+    uint64_t packets_num;                   /* Number of packets of the flow */
+    uint64_t bytes_num;                     /* Number of IP bytes of the flow */
+};
+
+/**
+ *  Write all flows of a flow buffer into a snapshot file
+ *  The file is written under a temporary name and renamed
+ *
+ *  @param  flow_buffer     pointer to a flow buffer
+ *  @param  path            path to a snapshot file
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_flow_snapshot_save(
+    struct lndpi_linked_list* flow_buffer,
+    const char* path
+);
+
+/**
+ *  Function freeing nDPI state of a flow
+ */
+typedef void (*lndpi_flow_hibernate_t)(struct lndpi_packet_flow* flow);
+
+/**
+ *  Put flows with finished detection from a snapshot file into a flow buffer
+ *  Restored flows keep their protocol and are not passed to nDPI again
+ *  Missing snapshot file is not an error
+ *
+ *  @param  flow_buffer         pointer to a flow buffer
+ *  @param  path                path to a snapshot file
+ *  @param  hibernate           function to free nDPI state of every restored flow
+ *  @param  restored_flows_num  buffer to store number of restored flows
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_flow_snapshot_load(
+    struct lndpi_linked_list* flow_buffer,
+    const char* path,
+    lndpi_flow_hibernate_t hibernate,
+    uint32_t* restored_flows_num
+);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef LNDPI_FRAME_BLOCK_H
+#define LNDPI_FRAME_BLOCK_H
+
+#include <stdint.h>
+
+#include <linux/if_packet.h>
+
+/**
+ *  Structure to track a TPACKET_V3 block whose frames are referenced by buffered packets
+ *  The block is given back to the kernel when it is closed and no packet references it
+ */
+struct lndpi_frame_block
+{
+    struct tpacket_block_desc* desc;        /* Pointer to the block descriptor in the ring */
+    uint32_t refs;                          /* Number of buffered packets referencing frames of the block */
+    uint8_t closed;                         /* 1 if all packets of the block were processed; 0 otherwise */
+};
+
+/**
+ *  Start tracking a block
+ *
+ *  @param  desc        pointer to a block descriptor in the ring
+ *  @return pointer to a new allocated structure or NULL
+ */
+struct lndpi_frame_block* lndpi_frame_block_open(struct tpacket_block_desc* desc);
+
+/**
+ *  Mark that all packets of a block were processed
+ *  The block is released if no packet references it
+ *
+ *  @param  block       pointer to a frame block
+ */
+void lndpi_frame_block_close(struct lndpi_frame_block* block);
+
+/**
+ *  Add a packet reference to a block
+ *
+ *  @param  block       pointer to a frame block
+ */
+void lndpi_frame_block_ref(struct lndpi_frame_block* block);
+
+/**
+ *  Remove a packet reference from a block
+ *  The block is released if it is closed and no packet references it
+ *
+ *  @param  block       pointer to a frame block
+ */
+void lndpi_frame_block_unref(struct lndpi_frame_block* block);
+
+/**
+ *  Give a block back to the kernel
+ *
+ *  @param  desc        pointer to a block descriptor in the ring
+ */
+void lndpi_frame_block_release(struct tpacket_block_desc* desc);
+
+/**
+ *  Get number of closed blocks which are still referenced by buffered packets
+ *
+ *  @return number of pinned blocks
+ */
+uint32_t lndpi_frame_block_pinned_num(void);
+
+/**
+ *  Get max number of blocks pinned at the same time since the last reset
+ *
+ *  @return max number of pinned blocks
+ */
+uint32_t lndpi_frame_block_max_pinned_num(void);
+
+/**
+ *  Reset max number of pinned blocks
+ */
+void lndpi_frame_block_reset_max_pinned_num(void);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef LNDPI_HOST_TABLE_H
+#define LNDPI_HOST_TABLE_H
+
+#include <stdint.h>
+
+#include "ndpi_api.h"
+#include "lndpi_errors.h"
+
+#include <arpa/inet.h>
+
+/**
+ *  Host table entry
+ *  nDPI id struct of the host is allocated right after the entry
+ */
+struct lndpi_host_entry
+{
+    struct in_addr addr;                    /* Host IP address */
+    uint32_t refs;                          /* Number of flow references */
+    uint64_t released_ms;                   /* Timestamp of the last flow packet when refs dropped to zero */
+    struct lndpi_host_entry* hash_next;     /* Next entry in the same hash bucket */
+    struct lndpi_host_entry* idle_prev;     /* Previous unreferenced entry; older one */
+    struct lndpi_host_entry* idle_next;     /* Next unreferenced entry; newer one */
+};
+
+/* Size of a host entry with its nDPI id struct */
+#define LNDPI_HOST_ENTRY_SIZE (sizeof(struct lndpi_host_entry) + SIZEOF_ID_STRUCT)
+
+/**
+ *  Table of nDPI id structs shared by all flows of a host
+ *  Unreferenced entries are kept in release order until they expire or are reused
+ */
+struct lndpi_host_table
+{
+    struct lndpi_host_entry** buckets;      /* Hash buckets */
+    uint32_t buckets_mask;                  /* Number of buckets minus one */
+    uint32_t max_entries;                   /* Max number of entries */
+    uint32_t entries_num;                   /* Current number of entries */
+    uint64_t ttl_ms;                        /* Time to keep an unreferenced entry */
+    struct lndpi_host_entry* idle_head;     /* Least recently released entry */
+    struct lndpi_host_entry* idle_tail;     /* Most recently released entry */
+    uint64_t overflows;                     /* Acquires failed because all entries were referenced */
+};
+
+/**
+ *  Allocate host table
+ *  Number of buckets is rounded up to a power of two
+ *
+ *  @param  table           pointer to a host table
+ *  @param  max_entries     max number of hosts
+ *  @param  ttl_ms          time to keep a host after its last flow is released
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_host_table_init(
+    struct lndpi_host_table* table,
+    uint32_t max_entries,
+    uint64_t ttl_ms
+);
+
+/**
+ *  Free host table and all its entries
+ *
+ *  @param  table           pointer to a host table
+ */
+void lndpi_host_table_exit(struct lndpi_host_table* table);
+
+/**
+ *  Get nDPI id struct of a host and take a reference to it
+ *  The least recently released entry is reused if the table is full
+ *
+ *  @param  table           pointer to a host table
+ *  @param  addr            host IP address
+ *  @return pointer to an id struct or NULL if all entries are referenced or memory is exhausted
+ */
+struct ndpi_id_struct* lndpi_host_table_acquire(struct lndpi_host_table* table, struct in_addr addr);
+
+/**
+ *  Drop a reference to an id struct taken by lndpi_host_table_acquire()
+ *
+ *  @param  table           pointer to a host table
+ *  @param  id_struct       pointer to an id struct or NULL
+ *  @param  time_ms         timestamp of the last packet of the releasing flow
+ */
+void lndpi_host_table_release(
+    struct lndpi_host_table* table,
+    struct ndpi_id_struct* id_struct,
+    uint64_t time_ms
+);
+
+/**
+ *  Free unreferenced entries which were released more than ttl ago
+ *
+ *  @param  table           pointer to a host table
+ *  @param  now_ms          current timestamp in milliseconds
+ */
+void lndpi_host_table_expire(struct lndpi_host_table* table, uint64_t now_ms);
+
+#endif
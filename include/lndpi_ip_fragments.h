@@ -0,0 +1,145 @@
+#ifndef LNDPI_IP_FRAGMENTS_H
+#define LNDPI_IP_FRAGMENTS_H
+
+#include <stdint.h>
+
+#include "lndpi_packet_flow.h"
+#include "lndpi_errors.h"
+
+/* Number of entries in one set of an IP fragment table */
+#define LNDPI_IP_FRAGMENT_WAYS 4
+
+/* Max size of an IPv4 header */
+#define LNDPI_IP_MAX_HEADER_SIZE 60
+
+/**
+ *  Fragmentation of an IPv4 packet
+ */
+enum lndpi_ip_fragment_type
+{
+    LNDPI_IP_NOT_FRAGMENT,                  /* Packet is not fragmented */
+    LNDPI_IP_FIRST_FRAGMENT,                /* First fragment which carries L4 header */
+    LNDPI_IP_NEXT_FRAGMENT                  /* Fragment with non-zero offset */
+};
+
+/**
+ *  State of one fragmented datagram
+ */
+struct lndpi_ip_fragment_entry
+{
+    uint64_t updated_ms;                    /* Timestamp of the last fragment */
+    struct in_addr src_addr;                /* Source IP address */
+    struct in_addr dst_addr;                /* Destination IP address */
+    uint16_t ip_id;                         /* Identification from IP header */
+    uint8_t ip_protocol;                    /* Protocol ID from IP header */
+    uint8_t valid;                          /* 1 if entry is used; 0 otherwise */
+    uint8_t ports_known;                    /* 1 if the first fragment was seen; 0 otherwise */
+    uint8_t reassembled;                    /* 1 if the datagram was reassembled; 0 otherwise */
+    uint16_t src_port;                      /* Source port from the first fragment */
+    uint16_t dst_port;                      /* Destination port from the first fragment */
+    uint8_t* datagram;                      /* Reassembly buffer: header area, payload and received blocks bitmap */
+    uint16_t header_length;                 /* Length of IP header of the first fragment; 0 until it is seen */
+    uint32_t payload_length;                /* Length of the datagram's payload; 0 until the last fragment is seen */
+};
+
+/**
+ *  Bounded set associative table of fragmented datagrams
+ *  Maps datagrams to ports of their first fragment and optionally reassembles them
+ */
+struct lndpi_ip_fragments
+{
+    struct lndpi_ip_fragment_entry* entries;    /* Sets of LNDPI_IP_FRAGMENT_WAYS entries */
+    uint32_t sets_mask;                         /* Number of sets minus one */
+    uint64_t ttl_ms;                            /* Time to live of an entry after its last fragment */
+    uint32_t max_datagram_size;                 /* Max payload of a reassembled datagram; 0 disables reassembly */
+};
+
+/**
+ *  Get fragmentation of an IPv4 packet
+ *
+ *  @param  iph             pointer to IP header
+ *  @return fragment type
+ */
+enum lndpi_ip_fragment_type lndpi_ip_fragment_type(const struct ndpi_iphdr* iph);
+
+/**
+ *  Allocate IP fragment table
+ *  Number of entries is rounded up to a power of two
+ *
+ *  @param  table               pointer to a fragment table
+ *  @param  size                max number of datagrams
+ *  @param  ttl_ms              time to live of an entry after its last fragment
+ *  @param  max_datagram_size   max payload of a reassembled datagram; 0 disables reassembly
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_ip_fragments_init(
+    struct lndpi_ip_fragments* table,
+    uint32_t size,
+    uint64_t ttl_ms,
+    uint32_t max_datagram_size
+);
+
+/**
+ *  Free IP fragment table
+ *
+ *  @param  table           pointer to a fragment table
+ */
+void lndpi_ip_fragments_exit(struct lndpi_ip_fragments* table);
+
+/**
+ *  Remember ports of the first fragment of a datagram
+ *
+ *  @param  table           pointer to a fragment table
+ *  @param  iph             pointer to IP header of the first fragment
+ *  @param  src_port        source port
+ *  @param  dst_port        destination port
+ *  @param  now_ms          current timestamp in milliseconds
+ */
+void lndpi_ip_fragments_put_ports(
+    struct lndpi_ip_fragments* table,
+    const struct ndpi_iphdr* iph,
+    uint16_t src_port,
+    uint16_t dst_port,
+    uint64_t now_ms
+);
+
+/**
+ *  Find ports of the first fragment of a datagram
+ *
+ *  @param  table           pointer to a fragment table
+ *  @param  iph             pointer to IP header of a fragment
+ *  @param  now_ms          current timestamp in milliseconds
+ *  @param  src_port        buffer to store source port
+ *  @param  dst_port        buffer to store destination port
+ *  @return 1 if the first fragment was seen; 0 otherwise
+ */
+uint8_t lndpi_ip_fragments_find_ports(
+    struct lndpi_ip_fragments* table,
+    const struct ndpi_iphdr* iph,
+    uint64_t now_ms,
+    uint16_t* src_port,
+    uint16_t* dst_port
+);
+
+/**
+ *  Add a fragment to its datagram
+ *  The returned datagram stays valid until the next call
+ *
+ *  @param  table           pointer to a fragment table
+ *  @param  iph             pointer to IP header of a fragment
+ *  @param  length          length of the fragment starting from IP header
+ *  @param  now_ms          current timestamp in milliseconds
+ *  @param  datagram        buffer to store pointer to the reassembled datagram
+ *  @param  datagram_length buffer to store length of the reassembled datagram
+ *  @return 1 if the fragment completed its datagram; 0 otherwise
+ */
+uint8_t lndpi_ip_fragments_reassemble(
+    struct lndpi_ip_fragments* table,
+    const struct ndpi_iphdr* iph,
+    uint16_t length,
+    uint64_t now_ms,
+    const uint8_t** datagram,
+    uint16_t* datagram_length
+);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef LNDPI_MEMORY_POOL_H
+#define LNDPI_MEMORY_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lndpi_errors.h"
+
+/**
+ *  Memory backing of preallocated pools
+ *  If a backing can't be used the next weaker one is tried
+ */
+enum lndpi_memory_backing
+{
+    LNDPI_MEMORY_BACKING_MALLOC,            /* No pools; every object is allocated by ndpi_malloc() */
+    LNDPI_MEMORY_BACKING_MMAP,              /* Anonymous mapping of regular pages */
+    LNDPI_MEMORY_BACKING_THP,               /* Anonymous mapping advised to use transparent huge pages */
+    LNDPI_MEMORY_BACKING_HUGETLB_2M,        /* MAP_HUGETLB mapping of 2M pages */
+    LNDPI_MEMORY_BACKING_HUGETLB_1G         /* MAP_HUGETLB mapping of 1G pages */
+};
+
+/**
+ *  Pools of objects allocated by the library
+ */
+enum lndpi_memory_pool_id
+{
+    LNDPI_MEMORY_POOL_FLOWS,                /* struct lndpi_packet_flow */
+    LNDPI_MEMORY_POOL_NDPI_FLOWS,           /* struct ndpi_flow_struct */
+    LNDPI_MEMORY_POOL_ID_STRUCTS,           /* struct ndpi_id_struct */
+    LNDPI_MEMORY_POOL_PACKETS,              /* struct lndpi_packet_struct */
+    LNDPI_MEMORY_POOL_LIST_ELEMENTS,        /* struct lndpi_linked_list_element */
+    LNDPI_MEMORY_POOLS_NUMBER
+};
+
+/**
+ *  Preallocate a pool of fixed size objects
+ *  Objects of all pools are freed by ndpi_free(), so the nDPI free function is replaced
+ *  while any pool is active; the library must not be used with custom nDPI allocators
+ *
+ *  @param  pool            pool to initialize
+ *  @param  object_size     size of one object
+ *  @param  objects_number  max number of objects in the pool
+ *  @param  backing         preferred memory backing
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_memory_pool_init(
+    enum lndpi_memory_pool_id pool,
+    size_t object_size,
+    uint32_t objects_number,
+    enum lndpi_memory_backing backing
+);
+
+/**
+ *  Make a NUMA node preferred for memory of all active pools
+ *  Must be called before objects are allocated from the pools
+ *
+ *  @param  node            node number
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_memory_pool_bind(int32_t node);
+
+/**
+ *  Unmap all pools and restore the nDPI free function
+ *  Every object taken from pools must be freed before
+ */
+void lndpi_memory_pool_exit(void);
+
+/**
+ *  Allocate an object
+ *  Falls back to ndpi_malloc() if the pool is not initialized or exhausted
+ *
+ *  @param  pool            pool to allocate from
+ *  @param  size            size of the object
+ *  @return pointer to an allocated object or NULL
+ */
+void* lndpi_memory_pool_alloc(enum lndpi_memory_pool_id pool, size_t size);
+
+/**
+ *  Get the weakest memory backing of active pools
+ *
+ *  @return memory backing
+ */
+enum lndpi_memory_backing lndpi_memory_pool_backing(void);
+
+/**
+ *  Get number of allocations which fell back to ndpi_malloc() because a pool was exhausted
+ *
+ *  @return number of allocations
+ */
+uint64_t lndpi_memory_pool_fallback_num(void);
+
+#endif
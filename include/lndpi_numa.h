@@ -0,0 +1,41 @@
+#ifndef LNDPI_NUMA_H
+#define LNDPI_NUMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lndpi_errors.h"
+
+/* Max NUMA node number supported by memory policy functions */
+#define LNDPI_NUMA_MAX_NODES 1024
+
+/**
+ *  Get NUMA node of a network interface's device
+ *
+ *  @param  interface_name  network interface name
+ *  @return node number or -1 if it is unknown
+ */
+int32_t lndpi_numa_interface_node(const char* interface_name);
+
+/**
+ *  Bind calling thread to CPUs of a NUMA node
+ *  and make the node preferred for its further memory allocations
+ *
+ *  @param  node            node number
+ *  @param  cpus_number     buffer to store number of CPUs the thread is bound to
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_numa_bind_thread(int32_t node, uint32_t* cpus_number);
+
+/**
+ *  Make a NUMA node preferred for pages of a memory range which are not touched yet
+ *  Can be used for a capture ring mapped by the application
+ *
+ *  @param  addr            page aligned start of the range
+ *  @param  size            size of the range
+ *  @param  node            node number
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_numa_bind_memory(void* addr, size_t size, int32_t node);
+
+#endif
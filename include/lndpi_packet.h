@@ -5,9 +5,101 @@
 
 #include "lndpi_errors.h"
 #include "lndpi_packet_buffers.h"
+#include "lndpi_memory_pool.h"
+#include "lndpi_flow_query.h"
 
 #include <linux/if_packet.h>
 
+/* Max number of packets parsed and prefetched ahead by lndpi_process_block() */
+#define LNDPI_MAX_PREFETCH_DEPTH 32
+
+/* Default number of packets parsed and prefetched ahead by lndpi_process_block() */
+#define LNDPI_DEFAULT_PREFETCH_DEPTH 8
+
+/* Max number of packets passed to packet batch callback function at once */
+#define LNDPI_PACKET_BATCH_SIZE 256
+
+/**
+ *  Action taken when a packet arrives while the packet buffer is full
+ *  EMIT_UNCLASSIFIED acts as GIVEUP_OLDEST for a packet whose flow still has buffered packets
+ *  so that packets of a flow are always passed to callbacks in order;
+ *  flows left unknown by it are given up once they time out
+ */
+enum lndpi_packet_buffer_policy
+{
+    LNDPI_PACKET_BUFFER_POLICY_ERROR,               /* Return LNDPI_PACKET_BUFFER_OVERFLOW */
+    LNDPI_PACKET_BUFFER_POLICY_GIVEUP_OLDEST,       /* Give up detection of the oldest buffered packet's flow and flush it */
+    LNDPI_PACKET_BUFFER_POLICY_DROP_NEWEST,         /* Drop the new packet */
+    LNDPI_PACKET_BUFFER_POLICY_EMIT_UNCLASSIFIED    /* Pass the new packet to packet callback without buffering and detection */
+};
+
+/**
+ *  Action taken when a new flow arrives while the flow buffer is full
+ */
+enum lndpi_flow_buffer_policy
+{
+    LNDPI_FLOW_BUFFER_POLICY_ERROR,                 /* Return LNDPI_FLOW_BUFFER_OVERFLOW */
+    LNDPI_FLOW_BUFFER_POLICY_EVICT                  /* Evict a flow chosen by CLOCK approximation of LRU */
+};
+
+/**
+ *  Memory pressure level relative to the memory budget
+ */
+enum lndpi_memory_pressure
+{
+    LNDPI_MEMORY_PRESSURE_NONE,                     /* Below 70% of the budget or no budget */
+    LNDPI_MEMORY_PRESSURE_LOW,                      /* Halve max packets to process and packet hold time */
+    LNDPI_MEMORY_PRESSURE_HIGH,                     /* Quarter them and give up the oldest unknown flows */
+    LNDPI_MEMORY_PRESSURE_CRITICAL                  /* One eighth of them and give up all buffered unknown flows */
+};
+
+/**
+ *  Library statistics
+ *  Counters updated for every packet stay zero if the library is built with LNDPI_NO_STATS
+ */
+struct lndpi_packet_lib_stats
+{
+    uint64_t dropped_packets;               /* Packets dropped by LNDPI_PACKET_BUFFER_POLICY_DROP_NEWEST */
+    uint64_t unclassified_packets;          /* Packets of unclassified flows emitted by LNDPI_PACKET_BUFFER_POLICY_EMIT_UNCLASSIFIED */
+    uint64_t forced_giveups;                /* Flows given up by LNDPI_PACKET_BUFFER_POLICY_GIVEUP_OLDEST */
+    uint64_t evicted_flows;                 /* Flows evicted by LNDPI_FLOW_BUFFER_POLICY_EVICT */
+    uint32_t restored_flows;                /* Flows restored from a snapshot file on initialization */
+    uint64_t detection_module_init_us;      /* Time spent on nDPI detection module initialization in microseconds */
+    uint64_t endpoint_cache_hits;           /* New flows which got protocol from the endpoint cache */
+    uint64_t endpoint_cache_misses;         /* New flows which were not found in the endpoint cache */
+    uint32_t pinned_blocks;                 /* Processed ring blocks kept from the kernel by buffered packets */
+    uint32_t max_pinned_blocks;             /* Max number of blocks pinned at the same time */
+    uint64_t provisional_packets;           /* Packets emitted before final protocol decision of their flow */
+    uint64_t housekeeping_runs;             /* Calls of the buffers callback function */
+    enum lndpi_memory_backing memory_backing;   /* Weakest memory backing which pools actually got */
+    uint64_t pool_fallback_allocations;     /* Allocations done by ndpi_malloc() because a pool was exhausted */
+    int32_t numa_node;                      /* NUMA node the library is bound to; -1 if not bound */
+    uint32_t numa_cpus;                     /* Number of CPUs of the NUMA node the thread is bound to */
+    uint64_t ip_fragments;                  /* Processed IP fragments */
+    uint64_t orphan_ip_fragments;           /* Non-first fragments whose first fragment was not seen */
+    uint64_t reassembled_ip_datagrams;      /* Fragmented datagrams reassembled for detection */
+    uint64_t closed_tcp_flows;              /* TCP flows closed by RST or FIN in both directions */
+    uint64_t hibernated_flows;              /* Flows whose nDPI state was freed after final protocol decision */
+    uint64_t hibernation_freed_bytes;       /* Memory freed by flow hibernation in bytes */
+    uint32_t hosts;                         /* Hosts in the host table */
+    uint64_t host_table_overflows;          /* Id structs not given to flows because the host table was full */
+    uint64_t hot_flow_cache_hits;           /* Flow lookups answered by the hot flow cache */
+    uint64_t hot_flow_cache_misses;         /* Flow lookups which went to the flow hash index */
+    uint64_t unsubscribed_flows;            /* Flow verdicts which matched no subscription */
+    uint64_t unsubscribed_packets;          /* Packets not passed to callbacks because their flow is not subscribed */
+    uint64_t flow_query_overflows;          /* Flows not published for queries because their bucket and its neighbour were full */
+    uint64_t flow_query_read_retries;       /* Flow query reads retried because a bucket was being updated */
+    uint64_t memory_usage;                  /* Estimated memory held by flows, nDPI state, hosts and buffered packets */
+    enum lndpi_memory_pressure memory_pressure;     /* Current memory pressure level */
+    uint64_t memory_pressure_rises;         /* Times memory pressure level went up */
+    uint64_t pressure_giveups;              /* Flows given up because of memory pressure */
+    uint32_t effective_max_packets_to_process;      /* Max packets to process currently applied */
+    uint64_t effective_max_packet_hold_ms;  /* Max packet hold time currently applied; 0 if unlimited */
+    uint64_t vlan_packets;                  /* Frames with a VLAN tag stripped by the kernel or left in the frame */
+    uint64_t malformed_packets;             /* Frames rejected because headers were truncated or inconsistent */
+    uint64_t non_ip_packets;                /* Frames rejected because they carry neither IPv4 nor IPv6 */
+};
+
 /**
  *  Packet callback function type
  *
@@ -26,6 +118,27 @@ typedef enum lndpi_error (*lndpi_packet_callback_t)(
     void* parameter
 );
 
+/**
+ *  Packet batch callback function type
+ *  Packets are in arrival order and are freed after the callback returns
+ *
+ *  @param  ndpi_struct             pointer to an nDPI detection module struct
+ *  @param  packets                 array of pointers to packet structs
+ *  @param  packets_num             number of packets in the array; at most LNDPI_PACKET_BATCH_SIZE
+ *  @param  timeout_ms              timeout in milliseconds for a flow
+ *  @param  max_packets_to_process  max number of packets to process without knowing protocol before give up
+ *  @param  parameter               parameter which can be passed to callback funcion
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+typedef enum lndpi_error (*lndpi_packet_batch_callback_t)(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct** packets,
+    uint32_t packets_num,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+);
+
 /**
  *  Buffers callback function type
  *
@@ -70,8 +183,23 @@ typedef enum lndpi_error (*lndpi_finalize_callback_t)(
     void* parameter
 );
 
+/**
+ *  Flow callback function type
+ *
+ *  @param  ndpi_struct             pointer to an nDPI detection module struct
+ *  @param  flow                    pointer to a flow
+ *  @param  parameter               parameter which can be passed to callback funcion
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+typedef enum lndpi_error (*lndpi_flow_callback_t)(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow,
+    void* parameter
+);
+
 /**
  * Set packet callback function
+ *  Only parameter is used if the library is built with LNDPI_STATIC_PACKET_CALLBACK
  *
  *  @param  packet_callback     packet callback function
  *  @param  parameter           parameter to pass to packet_callback
@@ -81,8 +209,22 @@ void lndpi_set_packet_callback_function(
     void* parameter
 );
 
+/**
+ *  Set packet batch callback function
+ *  If it is set, default buffers and finalize callbacks pass ready packets to it
+ *  once per drain instead of calling packet callback function for every packet
+ *
+ *  @param  packet_batch_callback   packet batch callback function or NULL to use packet callback function
+ *  @param  parameter               parameter to pass to packet_batch_callback
+ */
+void lndpi_set_packet_batch_callback_function(
+    lndpi_packet_batch_callback_t packet_batch_callback,
+    void* parameter
+);
+
 /**
  * Set buffers callback function
+ *  Only parameter is used if the library is built with LNDPI_STATIC_BUFFERS_CALLBACK
  *
  *  @param  buffers_callback    buffers callback function
  *  @param  parameter           parameter to pass to buffers_callback
@@ -103,6 +245,338 @@ void lndpi_set_finalize_callback_function(
     void* parameter
 );
 
+/**
+ *  Set flow eviction callback function
+ *  It is called for every flow evicted by LNDPI_FLOW_BUFFER_POLICY_EVICT before the flow is destroyed
+ *
+ *  @param  flow_eviction_callback  flow callback function or NULL
+ *  @param  parameter               parameter to pass to flow_eviction_callback
+ */
+void lndpi_set_flow_eviction_callback_function(
+    lndpi_flow_callback_t flow_eviction_callback,
+    void* parameter
+);
+
+/**
+ *  Set flow verdict callback function
+ *  It is called when a flow gets final protocol decision after some of its packets
+ *  were emitted with a provisional verdict
+ *
+ *  @param  flow_verdict_callback   flow callback function or NULL
+ *  @param  parameter               parameter to pass to flow_verdict_callback
+ */
+void lndpi_set_flow_verdict_callback_function(
+    lndpi_flow_callback_t flow_verdict_callback,
+    void* parameter
+);
+
+/**
+ *  Set number of packets parsed and prefetched ahead by lndpi_process_block()
+ *  Values are clamped to [1, LNDPI_MAX_PREFETCH_DEPTH]
+ *
+ *  @param  depth       number of packets
+ */
+void lndpi_set_prefetch_depth(uint32_t depth);
+
+/**
+ *  Set action taken when a packet arrives while the packet buffer is full
+ *  Default is LNDPI_PACKET_BUFFER_POLICY_ERROR
+ *
+ *  @param  policy      packet buffer overload policy
+ */
+void lndpi_set_packet_buffer_policy(enum lndpi_packet_buffer_policy policy);
+
+/**
+ *  Set action taken when a new flow arrives while the flow buffer is full
+ *  Default is LNDPI_FLOW_BUFFER_POLICY_ERROR
+ *
+ *  @param  policy      flow buffer overload policy
+ */
+void lndpi_set_flow_buffer_policy(enum lndpi_flow_buffer_policy policy);
+
+/**
+ *  Set preferences for nDPI detection module
+ *  Must be called before lndpi_packet_lib_init()
+ *  Default is ndpi_no_prefs
+ *
+ *  @param  prefs       nDPI initialization preferences
+ */
+void lndpi_set_detection_prefs(ndpi_init_prefs prefs);
+
+/**
+ *  Set protocols which nDPI detection module tries to detect
+ *  Must be called before lndpi_packet_lib_init()
+ *  Dissectors of protocols which are not in the bitmask are not run
+ *
+ *  @param  bitmask     pointer to a protocol bitmask or NULL to enable all protocols (default)
+ */
+void lndpi_set_detection_bitmask(const NDPI_PROTOCOL_BITMASK* bitmask);
+
+/**
+ *  Set a custom protocols file to load into nDPI detection module
+ *  Must be called before lndpi_packet_lib_init()
+ *
+ *  @param  protocols_file_path     path to an nDPI protocols file or NULL
+ */
+void lndpi_set_protocols_file_path(const char* protocols_file_path);
+
+/**
+ *  Set a custom categories file to load into nDPI detection module
+ *  Must be called before lndpi_packet_lib_init()
+ *
+ *  @param  categories_file_path    path to an nDPI categories file or NULL
+ */
+void lndpi_set_categories_file_path(const char* categories_file_path);
+
+/**
+ *  Subscribe to packets and flows of a protocol
+ *  Must be called before lndpi_packet_lib_init()
+ *  Once any subscription is registered, flows whose final verdict matches none of them
+ *  are not buffered and are not passed to packet, batch and flow callbacks
+ *  Packets emitted before the final verdict are passed as usual
+ *
+ *  @param  protocol_id     nDPI protocol ID matched against master and app protocols of a flow
+ */
+void lndpi_subscribe_protocol(uint16_t protocol_id);
+
+/**
+ *  Subscribe to packets and flows of a protocol category
+ *  Must be called before lndpi_packet_lib_init()
+ *
+ *  @param  category        nDPI protocol category; categories out of nDPI range are ignored
+ */
+void lndpi_subscribe_category(ndpi_protocol_category_t category);
+
+/**
+ *  Remove all subscriptions so every flow is passed to callbacks again (default)
+ *  Must be called before lndpi_packet_lib_init()
+ */
+void lndpi_clear_subscriptions(void);
+
+/**
+ *  Enable or disable protocol guessing when detection is given up
+ *  Default is enabled
+ *
+ *  @param  enable_guess    1 to guess protocol; 0 otherwise
+ */
+void lndpi_set_protocol_guessing(uint8_t enable_guess);
+
+/**
+ *  Set server endpoint cache parameters
+ *  Must be called before lndpi_packet_lib_init()
+ *  Final protocol detected by nDPI, or guessed on give up, is remembered for the flow's server
+ *  address, port and IP protocol; the endpoint with the lower port is taken as the server
+ *  New flows to a remembered endpoint get its protocol right away and are not passed to nDPI
+ *
+ *  @param  size        max number of remembered endpoints; 0 disables the cache (default)
+ *  @param  ttl_ms      time to live of a remembered endpoint in milliseconds
+ */
+void lndpi_set_endpoint_cache(uint32_t size, uint64_t ttl_ms);
+
+/**
+ *  Set number of slots of the hot flow cache
+ *  Must be called before lndpi_packet_lib_init()
+ *  Direct-mapped cache in front of the flow hash index which keeps the last flow found for each slot
+ *
+ *  @param  size        number of slots rounded up to a power of two; 0 disables the cache (default 256)
+ */
+void lndpi_set_hot_flow_cache_size(uint32_t size);
+
+/**
+ *  Enable or disable publishing of flows for queries from other threads
+ *  Must be called before lndpi_packet_lib_init()
+ *  Enabled table costs one sequence locked copy of flow state per packet
+ *
+ *  @param  enabled     1 to publish flows; 0 otherwise (default)
+ */
+void lndpi_set_flow_query(uint8_t enabled);
+
+/**
+ *  Get a copy of a flow by addresses in any direction
+ *  Safe to call from any thread between lndpi_packet_lib_init() and lndpi_packet_lib_exit()
+ *  Never blocks the processing thread
+ *  A flow is not found while its bucket and the neighbour one are full; with max_flow_number
+ *  flows alive this misses up to about 1% of them (see flow_query_overflows)
+ *
+ *  @param  src_addr        source IP address
+ *  @param  dst_addr        destination IP address
+ *  @param  src_port        source port
+ *  @param  dst_port        destination port
+ *  @param  ip_protocol     protocol ID from IP header
+ *  @param  info            buffer to store a copy of the flow
+ *  @return 1 if the flow was found; 0 if it was not found or flow query is disabled
+ */
+uint8_t lndpi_query_flow(
+    struct in_addr src_addr,
+    struct in_addr dst_addr,
+    uint16_t src_port,
+    uint16_t dst_port,
+    uint8_t ip_protocol,
+    struct lndpi_flow_info* info
+);
+
+/**
+ *  Get copies of published flows
+ *  Safe to call from any thread between lndpi_packet_lib_init() and lndpi_packet_lib_exit()
+ *  Never blocks the processing thread; flows are copied in small consistent groups,
+ *  not at a single moment
+ *
+ *  @param  infos           buffer to store copies of flows
+ *  @param  max_infos       max number of flows to copy
+ *  @return number of copied flows; 0 if flow query is disabled
+ */
+uint32_t lndpi_query_flows(struct lndpi_flow_info* infos, uint32_t max_infos);
+
+/**
+ *  Set host table parameters
+ *  Must be called before lndpi_packet_lib_init()
+ *  All flows of a host share one nDPI id struct which is kept for ttl_ms after its last flow is released
+ *  A flow gets no id struct for a host if the table is full of referenced hosts
+ *
+ *  @param  max_hosts   max number of hosts; 0 gives every flow its own id structs (default 65536)
+ *  @param  ttl_ms      time to keep a host without flows in milliseconds (default 300000)
+ */
+void lndpi_set_host_table(uint32_t max_hosts, uint64_t ttl_ms);
+
+/**
+ *  Enable or disable zero-copy mode
+ *  In zero-copy mode packets processed by lndpi_process_block() keep a pointer to their frame
+ *  in the ring, and lndpi_process_block() takes over giving blocks back to the kernel:
+ *  a block is released only after every packet referencing it went through the packet callback
+ *  Ring must stay mapped until lndpi_packet_lib_exit()
+ *
+ *  @param  enabled     1 to enable zero-copy mode; 0 otherwise (default)
+ */
+void lndpi_set_zero_copy(uint8_t enabled);
+
+/**
+ *  Set max time a packet of a flow with unknown protocol is kept in the packet buffer
+ *  Packets held longer are passed to the packet callback with a provisional verdict,
+ *  and the flow verdict callback is called once the flow's protocol is decided;
+ *  detection of the flow is given up by the default buffers callback when it times out
+ *  or reaches max number of processed packets
+ *
+ *  @param  max_packet_hold_ms  max hold time in milliseconds; 0 disables the limit (default)
+ */
+void lndpi_set_max_packet_hold_ms(uint64_t max_packet_hold_ms);
+
+/**
+ *  Set how often the buffers callback function is called while processing packets
+ *  Housekeeping runs when either of the limits is reached, when a buffer is full
+ *  and on every lndpi_poll() call
+ *  Default is after every packet
+ *
+ *  @param  packets         number of packets between runs; 0 disables the limit
+ *  @param  interval_ms     wall clock time in milliseconds between runs; 0 disables the limit
+ */
+void lndpi_set_housekeeping_interval(uint32_t packets, uint64_t interval_ms);
+
+/**
+ *  Set memory budget of the library
+ *  Usage is checked on housekeeping; at 70%, 85% and 95% of the budget the library lowers
+ *  max packets to process and packet hold time (flow timeout is the base if hold time is unlimited)
+ *  and at the upper levels gives up detection of flows with the oldest buffered packets
+ *  Settings are restored once usage drops 5% below a level
+ *
+ *  @param  budget_bytes    memory budget in bytes; 0 disables it (default)
+ */
+void lndpi_set_memory_budget(uint64_t budget_bytes);
+
+/**
+ *  Set memory backing of pools preallocated for flows, nDPI flow state, packets and buffer elements
+ *  A weaker backing is used if the requested one is not available:
+ *  1G huge pages, 2M huge pages, transparent huge pages, regular pages
+ *  With 1G huge pages, pools which would leave more than a quarter of their mapping unused
+ *  take 2M huge pages instead
+ *  Pools replace the nDPI free function, so custom nDPI allocators must not be used with them
+ *  Must be called before lndpi_packet_lib_init()
+ *
+ *  @param  backing     memory backing; LNDPI_MEMORY_BACKING_MALLOC disables pools (default)
+ */
+void lndpi_set_memory_backing(enum lndpi_memory_backing backing);
+
+/**
+ *  Set NUMA node to run on
+ *  lndpi_packet_lib_init() binds the calling thread to the node's CPUs and makes the node
+ *  preferred for memory of the detection module, buffers and pools
+ *  The library keeps global state, so every worker bound to its own node must be a separate process
+ *  Must be called before lndpi_packet_lib_init()
+ *
+ *  @param  node        node number; -1 disables binding (default)
+ */
+void lndpi_set_numa_node(int32_t node);
+
+/**
+ *  Set network interface whose device's NUMA node is used instead of lndpi_set_numa_node()
+ *  Nothing is bound if the node of the interface is unknown
+ *  Must be called before lndpi_packet_lib_init()
+ *
+ *  @param  interface_name  network interface name or NULL
+ */
+void lndpi_set_numa_interface(const char* interface_name);
+
+/**
+ *  Set IPv4 fragments handling
+ *  Non-first fragments are put into the flow of their first fragment found in a bounded table;
+ *  fragments whose first fragment was not seen get zero ports
+ *  With reassembly enabled fragments are passed to nDPI as whole datagrams once all of them arrived
+ *  Must be called before lndpi_packet_lib_init()
+ *
+ *  @param  table_size          max number of tracked datagrams; 0 disables the table (default 1024)
+ *  @param  ttl_ms              time to keep a datagram after its last fragment (default 30000)
+ *  @param  max_datagram_size   max payload of a reassembled datagram; 0 disables reassembly (default)
+ */
+void lndpi_set_ip_fragments(uint32_t table_size, uint64_t ttl_ms, uint32_t max_datagram_size);
+
+/**
+ *  Set timeouts of TCP flows according to their lifecycle
+ *  Closed flows are removed after the closed timeout once their packets are released,
+ *  and are preferred for eviction; flows with SYN but no reply or with FIN in one direction
+ *  use the half-open timeout
+ *  Flow timeout is used if it is shorter
+ *
+ *  @param  closed_timeout_ms       timeout of flows closed by RST or FIN in both directions; 0 disables it (default)
+ *  @param  half_open_timeout_ms    timeout of half-open and half-closed flows; 0 disables it (default)
+ */
+void lndpi_set_tcp_timeouts(uint64_t closed_timeout_ms, uint64_t half_open_timeout_ms);
+
+/**
+ *  Set flow hibernation
+ *  Hibernated flow frees its nDPI flow and id structs once its protocol is final
+ *  and nDPI has no extra dissection for it; ndpi_flow of such flow is NULL in callbacks
+ *  Flows restored from a snapshot are always hibernated as they have no nDPI state to keep
+ *
+ *  @param  enabled     1 to hibernate flows after detection (default); 0 to keep nDPI state until flow expires
+ */
+void lndpi_set_flow_hibernation(uint8_t enabled);
+
+/**
+ *  Set a snapshot file to restore flows from on library initialization
+ *  Must be called before lndpi_packet_lib_init()
+ *  Only flows with final protocol decision are restored; nDPI is not run for them again
+ *
+ *  @param  snapshot_file_path  path to a snapshot file written by lndpi_save_flow_snapshot() or NULL
+ */
+void lndpi_set_flow_snapshot_file_path(const char* snapshot_file_path);
+
+/**
+ *  Write the flow buffer into a snapshot file
+ *  Snapshot keeps addresses, detected protocol, counters and timestamps of every flow
+ *  in fixed size records which can be memory mapped
+ *
+ *  @param  snapshot_file_path  path to a snapshot file
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_save_flow_snapshot(const char* snapshot_file_path);
+
+/**
+ *  Get library statistics
+ *  Statistics are reset by lndpi_packet_lib_init()
+ *
+ *  @param  stats       buffer to store statistics
+ */
+void lndpi_get_stats(struct lndpi_packet_lib_stats* stats);
+
 /**
  *  Initialize library
  *
@@ -131,12 +605,37 @@ enum lndpi_error lndpi_init_log_file_path(char* log_file_path);
 /**
  *  Main processing function
  *  Process one packet and update information about the protocol of it's flow
+ *  Frame is laid out as in a TPACKET_V3 ring: L3 header starts at tp_net, and VLAN tags
+ *  left in the frame are skipped only if the sockaddr_ll after the header has ARPHRD_ETHER
  *
  *  @param  pkt     = pointer to a packet
  *  @return LNDPI_OK on a successful run and an error code otherwise
  */
 enum lndpi_error lndpi_process_packet(const struct tpacket3_hdr* pkt);
 
+/**
+ *  Run housekeeping explicitly
+ *  Call the buffers callback function to release ready packets and clean up timed out flows
+ *  Should be called periodically (e.g. on a poll() timeout or a timerfd tick)
+ *  so that buffers are flushed when no packets arrive
+ *
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_poll(void);
+
+/**
+ *  Batch processing function
+ *  Process all packets of a TPACKET_V3 block
+ *  Headers of the next packets are parsed and their flows are prefetched
+ *  before lookup and detection to overlap memory accesses
+ *  Processing continues after a failed packet
+ *  In zero-copy mode the block must not be given back to the kernel by caller
+ *
+ *  @param  block   pointer to a block descriptor
+ *  @return LNDPI_OK on a successful run and the first error code otherwise
+ */
+enum lndpi_error lndpi_process_block(struct tpacket_block_desc* block);
+
 /**
  *  Library finalize function
  *  Log all processed information
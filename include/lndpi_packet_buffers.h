@@ -10,6 +10,7 @@
 struct lndpi_linked_list_element
 {
     struct lndpi_linked_list_element* next;     /* Pointer to the next element */
+    struct lndpi_linked_list_element* prev;     /* Pointer to the previous element */
 
     union                                       /* Union to store pointer to data */
     {
@@ -27,8 +28,50 @@ struct lndpi_linked_list
     struct lndpi_linked_list_element* tail;     /* Pointer to the last element */
     uint32_t elements_number;                   /* Number of elements in the list */
     uint32_t max_elements_number;               /* Maximum allowed number of elements */
+    struct lndpi_packet_flow** buckets;         /* Hash index of a flow buffer; NULL for a packet buffer */
+    uint32_t buckets_mask;                      /* Number of hash buckets minus one */
+    struct lndpi_linked_list_element* clock_hand; /* Next eviction candidate of a flow buffer */
+    struct lndpi_packet_flow** hot_flows;       /* Direct-mapped cache of recently found flows; NULL if disabled */
+    uint32_t hot_flows_mask;                    /* Number of hot flow slots minus one */
+    uint64_t hot_flow_hits;                     /* Lookups answered by the hot flow cache */
+    uint64_t hot_flow_misses;                   /* Lookups which went to the hash index */
 };
 
+/**
+ *  Allocate hash index of a flow buffer
+ *  Number of buckets is the smallest power of two not less than max_flow_number
+ *
+ *  @param  flow_buffer         pointer to flow buffer
+ *  @param  max_flow_number     max number of flows to store in a buffer
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_flow_buffer_index_init(
+    struct lndpi_linked_list* flow_buffer,
+    uint32_t max_flow_number
+);
+
+/**
+ *  Allocate hot flow cache of a flow buffer
+ *  Each slot keeps the flow last found for hashes mapped to it, so back-to-back packets
+ *  of the same flow skip the hash index
+ *  Number of slots is rounded up to a power of two
+ *
+ *  @param  flow_buffer     pointer to flow buffer
+ *  @param  size            number of slots; 0 disables the cache
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_flow_buffer_hot_cache_init(
+    struct lndpi_linked_list* flow_buffer,
+    uint32_t size
+);
+
+/**
+ *  Free hash index and hot flow cache of a flow buffer
+ *
+ *  @param  flow_buffer     pointer to flow buffer
+ */
+void lndpi_flow_buffer_index_exit(struct lndpi_linked_list* flow_buffer);
+
 /**
  *  Free all memory allocated by flow structures
  *  Delete all elements
@@ -39,12 +82,14 @@ void lndpi_flow_buffer_clear(struct lndpi_linked_list* flow_buffer);
 
 /**
  *  Find flow in a buffer with corresponding addresses
+ *  Hot flow cache is checked before the hash index
  *
  *  @param  flow_buffer     pointer to flow buffer
  *  @param  src_addr        source IP address
  *  @param  dst_addr        destination IP address
  *  @param  src_port        source port
  *  @param  dst_port        destination port
+ *  @param  hash            hash of addresses computed by lndpi_packet_flow_hash()
  *  @param  direction       buffer to store direction of given addresses
  *  @return pointer to the found flow or NULL
  */
@@ -54,9 +99,27 @@ struct lndpi_packet_flow* lndpi_flow_buffer_find(
     struct in_addr dst_addr,
     uint16_t src_port,
     uint16_t dst_port,
+    uint32_t hash,
     int8_t* direction
 );
 
+/**
+ *  Prefetch hash bucket and hot flow cache slot of a flow buffer
+ *
+ *  @param  flow_buffer     pointer to flow buffer
+ *  @param  hash            hash of addresses computed by lndpi_packet_flow_hash()
+ */
+void lndpi_flow_buffer_prefetch_bucket(struct lndpi_linked_list* flow_buffer, uint32_t hash);
+
+/**
+ *  Prefetch flow of a hot flow cache slot or first flow of a hash bucket
+ *  Should be called some time after lndpi_flow_buffer_prefetch_bucket() for the same hash
+ *
+ *  @param  flow_buffer     pointer to flow buffer
+ *  @param  hash            hash of addresses computed by lndpi_packet_flow_hash()
+ */
+void lndpi_flow_buffer_prefetch_flow(struct lndpi_linked_list* flow_buffer, uint32_t hash);
+
 /**
  *  Put a new flow in a buffer
  *
@@ -77,6 +140,17 @@ enum lndpi_error lndpi_flow_buffer_put(
  */
 void lndpi_flow_buffer_cleanup(struct lndpi_linked_list* flow_buffer, uint64_t timeout_ms);
 
+/**
+ *  Remove a flow from a full buffer to make room for a new one
+ *  CLOCK hand scans a bounded number of flows and prefers flows which are
+ *  not referenced since the last scan or closed by TCP, have finished detection and have no buffered packets
+ *  Flows with buffered packets are never evicted
+ *
+ *  @param  flow_buffer     pointer to a flow buffer
+ *  @return pointer to the removed flow which should be destroyed by caller or NULL if no flow can be evicted
+ */
+struct lndpi_packet_flow* lndpi_flow_buffer_evict(struct lndpi_linked_list* flow_buffer);
+
 /**
  *  Remove and free all flows from a buffer
  *
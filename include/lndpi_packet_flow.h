@@ -5,9 +5,22 @@
 #include <stdint.h>
 
 #include <arpa/inet.h>
+#include <linux/if_packet.h>
 
 #include "ndpi_api.h"
 
+/* TCP lifecycle flags of a flow */
+#define LNDPI_TCP_SYN       0x01            /* SYN was seen */
+#define LNDPI_TCP_REPLY     0x02            /* Formal destination sent a packet */
+#define LNDPI_TCP_SRC_FIN   0x04            /* Formal source sent FIN */
+#define LNDPI_TCP_DST_FIN   0x08            /* Formal destination sent FIN */
+#define LNDPI_TCP_RST       0x10            /* RST was seen */
+
+/* Subscription state of a flow */
+#define LNDPI_SUBSCRIPTION_UNKNOWN          0   /* Not evaluated since the last verdict change */
+#define LNDPI_SUBSCRIPTION_SUBSCRIBED       1   /* Verdict matches a subscription */
+#define LNDPI_SUBSCRIPTION_NOT_SUBSCRIBED   2   /* Verdict matches no subscription */
+
 /**
  *  Structure to describe packet flow
  *  Formal source is the source of the first arrivedc packet of the flow
@@ -17,20 +30,37 @@ struct lndpi_packet_flow
 {
     uint32_t id;                            /* ID */
     uint64_t last_packet_ms;                /* Timestamp for the last packet arrived */
-    struct ndpi_flow_struct* ndpi_flow;     /* Pointer to nDPI flow state machine */
+    struct ndpi_flow_struct* ndpi_flow;     /* Pointer to nDPI flow state machine; NULL if flow is hibernated */
     struct in_addr src_addr;                /* Formal source IP address */
     struct in_addr dst_addr;                /* Formal destination IP address */
     uint16_t src_port;                      /* Formal source port */
     uint16_t dst_port;                      /* Formal destination port */
-    struct ndpi_id_struct* src_id_struct;   /* Formal source state machine */
-    struct ndpi_id_struct* dst_id_struct;   /* Formal destination state machine */
+    struct ndpi_id_struct* src_id_struct;   /* Formal source state machine; NULL if flow is hibernated */
+    struct ndpi_id_struct* dst_id_struct;   /* Formal destination state machine; NULL if flow is hibernated */
     ndpi_protocol protocol;                 /* Protocol detected by nDPI */
     uint32_t processed_packets_num;         /* Number of processed packets to detect protocol */
     uint32_t buffered_packets_num;          /* Number of packets that are currently in the packet buffer */
     uint8_t ip_protocol;                    /* Protocol ID from IP header */
     uint8_t protocol_was_guessed;           /* 1 if protocol was guessed after giving up; 0 otherwise */
+    uint8_t detection_given_up;             /* 1 if detection was given up; 0 otherwise */
+    uint8_t referenced;                     /* 1 if flow got a packet since the last eviction scan; 0 otherwise */
+    uint8_t restored;                       /* 1 if flow was restored from a snapshot; 0 otherwise */
+    uint8_t protocol_from_cache;            /* 1 if protocol was taken from the endpoint cache; 0 otherwise */
+    uint8_t provisional_packets_emitted;    /* 1 if some packets were emitted before final protocol decision; 0 otherwise */
+    uint8_t tcp_state;                      /* LNDPI_TCP_* flags seen in the flow */
+    uint8_t subscription;                   /* LNDPI_SUBSCRIPTION_* state of the flow's verdict */
+    uint32_t hash;                          /* Direction independent hash of the flow's addresses */
+    struct lndpi_packet_flow* hash_next;    /* Next flow in the same flow buffer hash bucket */
+    uint64_t packets_num;                   /* Number of packets of the flow */
+    uint64_t bytes_num;                     /* Number of IP bytes of the flow */
+    struct lndpi_flow_query_bucket* query_bucket;   /* Flow query bucket the flow is published in; NULL if not published */
+    uint8_t query_way;                      /* Entry of the flow in its flow query bucket */
 };
 
+struct lndpi_frame_block;
+struct lndpi_host_table;
+struct lndpi_flow_query_bucket;
+
 /**
  *  Structure to describe packet
  */
@@ -40,11 +70,25 @@ struct lndpi_packet_struct
     struct lndpi_packet_flow* lndpi_flow;   /* Pointer to packet's flow */
     uint16_t length;                        /* Packet length */
     int8_t direction;                       /* Packet's direction regarding flow's formal parameters */
+    const struct tpacket3_hdr* frame;       /* Original frame in the ring; NULL unless zero-copy mode is enabled */
+    struct lndpi_frame_block* frame_block;  /* Block holding the original frame; NULL unless zero-copy mode is enabled */
+    uint8_t provisional;                    /* 1 if packet is emitted before final protocol decision of its flow; 0 otherwise */
 };
 
+/**
+ *  Set a host table to take id structs of new flows from
+ *  Flows allocate their own id structs if there is no host table
+ *  Must not be changed while any flow exists
+ *
+ *  @param  table           pointer to a host table or NULL
+ */
+void lndpi_packet_flow_set_host_table(struct lndpi_host_table* table);
+
 /**
  *  Allocate memory and initialize packet flow structure
  *  Allocate memory for state machines
+ *  Id structs are shared with other flows of the same hosts if a host table is set;
+ *  they are NULL if the host table is full
  *
  *  @param  src_addr        formal source IP address
  *  @param  dst_addr        formal destination IP address
@@ -61,16 +105,95 @@ struct lndpi_packet_flow* lndpi_packet_flow_init(
     uint8_t ip_protocol
 );
 
+/**
+ *  Compute a hash of flow addresses
+ *  Hash is the same for both directions of a flow
+ *
+ *  @param  src_addr    source IP address
+ *  @param  dst_addr    destination IP address
+ *  @param  src_port    source port
+ *  @param  dst_port    destination port
+ *  @return hash value
+ */
+uint32_t lndpi_packet_flow_hash(
+    struct in_addr src_addr,
+    struct in_addr dst_addr,
+    uint16_t src_port,
+    uint16_t dst_port
+);
+
+/**
+ *  Free memory allocated for state machines of packet flow
+ *  Shared id structs are released to the host table
+ *  Hibernated flow keeps its addresses, protocol, counters and timestamps only
+ *
+ *  @param  pkt_flow        pointer to packet flow structure
+ *  @return number of freed bytes of flow's own state machines; 0 if flow was already hibernated
+ */
+uint32_t lndpi_packet_flow_hibernate(struct lndpi_packet_flow* pkt_flow);
+
+/**
+ *  Get memory held by state machines of all flows
+ *  Id structs shared through a host table are not included
+ *
+ *  @return number of bytes
+ */
+uint64_t lndpi_packet_flow_state_bytes(void);
+
+/**
+ *  Check if packet flow is hibernated
+ *
+ *  @param  pkt_flow        pointer to packet flow structure
+ *  @return 1 if state machines of the flow were freed; 0 otherwise
+ */
+uint8_t lndpi_packet_flow_hibernated(struct lndpi_packet_flow* pkt_flow);
+
 /**
  *  Free memory allocated for state machines
+ *  Remove the flow from a flow query table if it is published
  *  Free memory allocated for packet flow structure
  *
  *  @param  pkt_flow        pointer to previously allocated packet flow structure
  */
 void lndpi_packet_flow_destroy(struct lndpi_packet_flow* pkt_flow);
 
+/**
+ *  Get current time in the same clock as packet timestamps
+ *
+ *  @return current timestamp in milliseconds
+ */
+uint64_t lndpi_current_time_ms(void);
+
+/**
+ *  Set timeouts of TCP flows which are closed or not fully established
+ *  Shorter one of them and flow timeout is used
+ *
+ *  @param  closed_timeout_ms       timeout of flows closed by RST or FIN in both directions; 0 disables it
+ *  @param  half_open_timeout_ms    timeout of flows with SYN but no reply or FIN in one direction; 0 disables it
+ */
+void lndpi_packet_flow_set_tcp_timeouts(uint64_t closed_timeout_ms, uint64_t half_open_timeout_ms);
+
+/**
+ *  Update TCP lifecycle of packet flow
+ *
+ *  @param  flow        pointer to packet flow structure
+ *  @param  tcp_flags   flags byte of TCP header
+ *  @param  direction   packet's direction regarding flow's formal parameters
+ *  @return 1 if the packet closed the flow; 0 otherwise
+ */
+uint8_t lndpi_packet_flow_update_tcp_state(struct lndpi_packet_flow* flow, uint8_t tcp_flags, int8_t direction);
+
+/**
+ *  Check if TCP connection of packet flow is closed
+ *
+ *  @param  flow        pointer to packet flow structure
+ *  @return 1 if RST or FIN in both directions was seen; 0 otherwise
+ */
+uint8_t lndpi_packet_flow_tcp_closed(struct lndpi_packet_flow* flow);
+
 /**
  *  Check if packet flow is timed out
+ *  Closed and half-open TCP flows use their own timeouts if they are shorter
  *
  *  @param  flow        pointer to packet flow structure
  *  @param  timeout_ms  timeout duration in milliseconds
@@ -78,6 +201,14 @@ void lndpi_packet_flow_destroy(struct lndpi_packet_flow* pkt_flow);
  */
 uint8_t lndpi_packet_flow_check_timeout(struct lndpi_packet_flow* flow, uint64_t timeout_ms);
 
+/**
+ *  Check if protocol detection of packet flow is finished
+ *
+ *  @param  flow        pointer to packet flow structure
+ *  @return 1 if protocol is known or detection was given up; 0 otherwise
+ */
+uint8_t lndpi_packet_flow_detection_finished(struct lndpi_packet_flow* flow);
+
 /**
  *  Compare packet flow structure to a given addresses
  *
@@ -0,0 +1,186 @@
+#ifndef LNDPI_RESULT_RING_H
+#define LNDPI_RESULT_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lndpi_errors.h"
+
+/* Magic number of a result ring header */
+#define LNDPI_RESULT_RING_MAGIC 0x52524e4c
+
+/* Version of the result ring layout */
+#define LNDPI_RESULT_RING_VERSION 1
+
+struct ndpi_detection_module_struct;
+struct lndpi_packet_struct;
+struct lndpi_packet_flow;
+
+/**
+ *  Type of a result record
+ */
+enum lndpi_result_record_type
+{
+    LNDPI_RESULT_RECORD_PACKET = 1,         /* Verdict of an emitted packet */
+    LNDPI_RESULT_RECORD_FLOW = 2            /* Final verdict or eviction of a flow */
+};
+
+/**
+ *  Fixed layout result record
+ *  Addresses are in network byte order, ports are in host byte order
+ *  Packet records are oriented by the packet's direction
+ */
+struct lndpi_result_record
+{
+    uint64_t seq;                           /* Sequence number plus one; 0 while the record is written */
+    uint64_t time_ms;                       /* Packet timestamp or flow's last packet timestamp */
+    uint32_t flow_id;                       /* ID of the flow */
+    uint32_t src_addr;                      /* Source IP address */
+    uint32_t dst_addr;                      /* Destination IP address */
+    uint16_t src_port;                      /* Source port */
+    uint16_t dst_port;                      /* Destination port */
+    uint16_t master_protocol;               /* Master protocol ID detected by nDPI */
+    uint16_t app_protocol;                  /* Application protocol ID detected by nDPI */
+    uint32_t category;                      /* Protocol category ID */
+    uint32_t processed_packets_num;         /* Number of packets processed by nDPI */
+    uint16_t length;                        /* Packet length; 0 for flow records */
+    uint8_t type;                           /* enum lndpi_result_record_type */
+    uint8_t ip_protocol;                    /* Protocol ID from IP header */
+    uint8_t protocol_was_guessed;           /* 1 if protocol was guessed; 0 otherwise */
+    uint8_t provisional;                    /* 1 if packet was emitted before final protocol decision */
+    uint8_t reserved[10];
+};
+
+/**
+ *  Header of a shared memory result ring
+ *  Records follow the header
+ */
+struct lndpi_result_ring_header
+{
+    uint32_t magic;                         /* LNDPI_RESULT_RING_MAGIC */
+    uint32_t version;                       /* LNDPI_RESULT_RING_VERSION */
+    uint32_t record_size;                   /* Size of one record */
+    uint32_t records_number;                /* Number of records; power of two */
+    uint64_t write_seq __attribute__((aligned(64)));   /* Number of records ever written */
+} __attribute__((aligned(64)));
+
+/**
+ *  Writer side of a result ring
+ *  The writer never waits for readers; readers which fall behind lose the oldest records
+ */
+struct lndpi_result_ring
+{
+    struct lndpi_result_ring_header* header;    /* Mapped header; NULL if ring is not created */
+    struct lndpi_result_record* records;        /* Mapped records */
+    uint32_t mask;                              /* Number of records minus one */
+    uint64_t write_seq;                         /* Local copy of the header's write_seq */
+    size_t map_size;                            /* Size of the mapping */
+    char name[64];                              /* Shared memory object name */
+};
+
+/**
+ *  Reader side of a result ring
+ */
+struct lndpi_result_ring_reader
+{
+    const struct lndpi_result_ring_header* header;  /* Mapped header; NULL if not attached */
+    const struct lndpi_result_record* records;      /* Mapped records */
+    uint32_t mask;                                  /* Number of records minus one */
+    uint64_t read_seq;                              /* Sequence number of the next record to read */
+    uint64_t lost_records;                          /* Records overwritten before they were read */
+    size_t map_size;                                /* Size of the mapping */
+};
+
+/**
+ *  Create a shared memory result ring
+ *  Number of records is rounded up to a power of two
+ *
+ *  @param  ring            pointer to a result ring
+ *  @param  name            shared memory object name, e.g. "/lndpi-results"
+ *  @param  records_number  number of records
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_result_ring_create(
+    struct lndpi_result_ring* ring,
+    const char* name,
+    uint32_t records_number
+);
+
+/**
+ *  Unmap and unlink a result ring
+ *
+ *  @param  ring            pointer to a result ring
+ */
+void lndpi_result_ring_destroy(struct lndpi_result_ring* ring);
+
+/**
+ *  Append a record to a result ring
+ *  The seq field of the record is ignored
+ *
+ *  @param  ring            pointer to a result ring
+ *  @param  record          record to append
+ */
+void lndpi_result_ring_write(struct lndpi_result_ring* ring, const struct lndpi_result_record* record);
+
+/**
+ *  Packet callback function which writes packet verdicts into a result ring
+ *
+ *  @param  ndpi_struct             pointer to an nDPI detection module struct
+ *  @param  packet                  pointer to a packet struct
+ *  @param  timeout_ms              timeout in milliseconds for a flow
+ *  @param  max_packets_to_process  max number of packets to process without knowing protocol before give up
+ *  @param  parameter               pointer to a result ring
+ *  @return LNDPI_OK
+ */
+enum lndpi_error lndpi_result_ring_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+);
+
+/**
+ *  Flow callback function which writes flow verdicts into a result ring
+ *  Can be used as flow verdict and flow eviction callback function
+ *
+ *  @param  ndpi_struct     pointer to an nDPI detection module struct
+ *  @param  flow            pointer to a flow
+ *  @param  parameter       pointer to a result ring
+ *  @return LNDPI_OK
+ */
+enum lndpi_error lndpi_result_ring_flow_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow,
+    void* parameter
+);
+
+/**
+ *  Attach to a result ring created by another process
+ *  Reading starts from the next written record
+ *
+ *  @param  reader          pointer to a result ring reader
+ *  @param  name            shared memory object name
+ *  @return LNDPI_OK on a successful run and an error code otherwise
+ */
+enum lndpi_error lndpi_result_ring_attach(struct lndpi_result_ring_reader* reader, const char* name);
+
+/**
+ *  Read the next record
+ *  If the writer has overwritten unread records, reading continues from the oldest
+ *  available one and lost_records of the reader is increased
+ *
+ *  @param  reader          pointer to a result ring reader
+ *  @param  record          buffer to store the record
+ *  @return 1 if a record was read; 0 if there are no new records
+ */
+uint8_t lndpi_result_ring_read(struct lndpi_result_ring_reader* reader, struct lndpi_result_record* record);
+
+/**
+ *  Detach from a result ring
+ *
+ *  @param  reader          pointer to a result ring reader
+ */
+void lndpi_result_ring_detach(struct lndpi_result_ring_reader* reader);
+
+#endif
@@ -0,0 +1,963 @@
+#include "lndpi_columnar_sink.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Columnar sink writes Arrow buffers in native byte order which must be little endian"
+#endif
+
+/* Arrow metadata constants */
+#define LNDPI_ARROW_METADATA_V5 4
+#define LNDPI_ARROW_HEADER_SCHEMA 1
+#define LNDPI_ARROW_HEADER_DICTIONARY_BATCH 2
+#define LNDPI_ARROW_HEADER_RECORD_BATCH 3
+#define LNDPI_ARROW_TYPE_INT 2
+#define LNDPI_ARROW_TYPE_UTF8 5
+#define LNDPI_ARROW_TYPE_BOOL 6
+#define LNDPI_ARROW_TYPE_TIMESTAMP 10
+#define LNDPI_ARROW_TIME_UNIT_MILLISECOND 1
+#define LNDPI_ARROW_CONTINUATION 0xffffffffu
+
+/* Max number of fields of one flatbuffer table */
+#define LNDPI_FB_MAX_FIELDS 8
+
+/**
+ *  Batch of records stored by columns
+ */
+struct lndpi_columnar_batch
+{
+    uint32_t rows;
+    uint32_t flow_id[LNDPI_COLUMNAR_BATCH_ROWS];
+    int64_t time_ms[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint32_t src_addr[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint32_t dst_addr[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint16_t src_port[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint16_t dst_port[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint16_t length[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint8_t ip_protocol[LNDPI_COLUMNAR_BATCH_ROWS];
+    int16_t master_protocol[LNDPI_COLUMNAR_BATCH_ROWS];
+    int16_t app_protocol[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint32_t category[LNDPI_COLUMNAR_BATCH_ROWS];
+    uint8_t guessed[LNDPI_COLUMNAR_BATCH_ROWS / 8];
+    struct lndpi_columnar_batch* next;
+};
+
+/**
+ *  Kind of a column
+ */
+enum lndpi_columnar_column_type
+{
+    LNDPI_COLUMN_UINT,
+    LNDPI_COLUMN_TIMESTAMP,
+    LNDPI_COLUMN_PROTOCOL,
+    LNDPI_COLUMN_BOOL
+};
+
+/**
+ *  Column description used to write both schema and record batches
+ */
+struct lndpi_columnar_column
+{
+    const char* name;
+    enum lndpi_columnar_column_type type;
+    uint8_t bit_width;                      /* Width of a value; 0 for bit packed columns */
+    size_t offset;                          /* Offset of the column in a batch */
+};
+
+static const struct lndpi_columnar_column s_columns[] = {
+    { "flow_id",            LNDPI_COLUMN_UINT,      32, offsetof(struct lndpi_columnar_batch, flow_id) },
+    { "time",               LNDPI_COLUMN_TIMESTAMP, 64, offsetof(struct lndpi_columnar_batch, time_ms) },
+    { "src_addr",           LNDPI_COLUMN_UINT,      32, offsetof(struct lndpi_columnar_batch, src_addr) },
+    { "dst_addr",           LNDPI_COLUMN_UINT,      32, offsetof(struct lndpi_columnar_batch, dst_addr) },
+    { "src_port",           LNDPI_COLUMN_UINT,      16, offsetof(struct lndpi_columnar_batch, src_port) },
+    { "dst_port",           LNDPI_COLUMN_UINT,      16, offsetof(struct lndpi_columnar_batch, dst_port) },
+    { "length",             LNDPI_COLUMN_UINT,      16, offsetof(struct lndpi_columnar_batch, length) },
+    { "ip_protocol",        LNDPI_COLUMN_UINT,      8,  offsetof(struct lndpi_columnar_batch, ip_protocol) },
+    { "master_protocol",    LNDPI_COLUMN_PROTOCOL,  16, offsetof(struct lndpi_columnar_batch, master_protocol) },
+    { "app_protocol",       LNDPI_COLUMN_PROTOCOL,  16, offsetof(struct lndpi_columnar_batch, app_protocol) },
+    { "category",           LNDPI_COLUMN_UINT,      32, offsetof(struct lndpi_columnar_batch, category) },
+    { "guessed",            LNDPI_COLUMN_BOOL,      0,  offsetof(struct lndpi_columnar_batch, guessed) }
+};
+
+#define LNDPI_COLUMNS_NUMBER (sizeof(s_columns) / sizeof(s_columns[0]))
+
+struct lndpi_columnar_sink
+{
+    /* Producer side */
+    struct lndpi_columnar_batch* current;   /* Batch being filled */
+
+    /* Shared between producer and writer thread */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t queued_cond;             /* Signalled when a batch is queued or sink is stopped */
+    pthread_cond_t free_cond;               /* Signalled when a batch is written */
+    struct lndpi_columnar_batch* queue_head;
+    struct lndpi_columnar_batch* queue_tail;
+    struct lndpi_columnar_batch* free_batches;
+    uint8_t stop;
+    enum lndpi_error error;                 /* First writer error */
+
+    /* Protocol names dictionary, built from the first record's detection module */
+    char* dictionary_data;                  /* Concatenated protocol names */
+    int32_t* dictionary_offsets;            /* Offsets of names in dictionary_data */
+    uint32_t dictionary_size;               /* Number of protocol names */
+
+    /* Writer thread side */
+    FILE* file;
+    uint64_t file_bytes;
+    uint64_t file_opened_ms;
+    uint32_t file_index;
+    uint64_t rotate_bytes;
+    uint64_t rotate_ms;
+    char path_prefix[256];
+};
+
+/**
+ *  Flatbuffer builder
+ *  Buffer is filled from the end, so objects are created before tables referencing them
+ *  Positions are counted from the end of the buffer
+ */
+struct lndpi_fb
+{
+    uint8_t* buf;
+    size_t cap;
+    size_t size;
+    uint8_t failed;
+};
+
+/**
+ *  Flatbuffer table field
+ */
+struct lndpi_fb_field
+{
+    uint16_t id;                            /* Field ID from the schema */
+    uint8_t size;                           /* Size of a scalar; 4 for offsets */
+    uint8_t is_offset;                      /* 1 if value is a position of a referenced object */
+    uint64_t value;                         /* Scalar value or position */
+};
+
+static void lndpi_fb_init(struct lndpi_fb* fb)
+{
+    fb->cap = 1024;
+    fb->size = 0;
+    fb->failed = (fb->buf = (uint8_t*)malloc(fb->cap)) == NULL;
+}
+
+static void lndpi_fb_push(struct lndpi_fb* fb, const void* data, size_t n)
+{
+    if (fb->failed)
+        return;
+
+    if (fb->size + n > fb->cap)
+    {
+        size_t cap = fb->cap;
+        uint8_t* buf;
+
+        while (cap < fb->size + n)
+            cap *= 2;
+
+        if ((buf = (uint8_t*)malloc(cap)) == NULL)
+        {
+            fb->failed = 1;
+            return;
+        }
+
+        memcpy(buf + cap - fb->size, fb->buf + fb->cap - fb->size, fb->size);
+        free(fb->buf);
+
+        fb->buf = buf;
+        fb->cap = cap;
+    }
+
+    fb->size += n;
+    memcpy(fb->buf + fb->cap - fb->size, data, n);
+}
+
+/**
+ *  Pad so that an object of extra bytes pushed next ends aligned
+ */
+static void lndpi_fb_align(struct lndpi_fb* fb, size_t align, size_t extra)
+{
+    static const uint8_t zero = 0;
+
+    while ((fb->size + extra) % align != 0)
+        lndpi_fb_push(fb, &zero, 1);
+}
+
+static void lndpi_fb_push_uoffset(struct lndpi_fb* fb, uint32_t target)
+{
+    lndpi_fb_align(fb, 4, 0);
+
+    uint32_t value = fb->size + 4 - target;
+
+    lndpi_fb_push(fb, &value, 4);
+}
+
+static uint32_t lndpi_fb_string(struct lndpi_fb* fb, const char* str)
+{
+    uint32_t len = strlen(str);
+
+    lndpi_fb_align(fb, 4, len + 1);
+    lndpi_fb_push(fb, "", 1);
+    lndpi_fb_push(fb, str, len);
+    lndpi_fb_push(fb, &len, 4);
+
+    return fb->size;
+}
+
+static uint32_t lndpi_fb_offset_vector(struct lndpi_fb* fb, const uint32_t* targets, uint32_t n)
+{
+    for (uint32_t i = n; i > 0; --i)
+        lndpi_fb_push_uoffset(fb, targets[i - 1]);
+
+    lndpi_fb_align(fb, 4, 0);
+    lndpi_fb_push(fb, &n, 4);
+
+    return fb->size;
+}
+
+/**
+ *  Vector of structs of two longs (Arrow FieldNode and Buffer)
+ */
+static uint32_t lndpi_fb_pair_vector(struct lndpi_fb* fb, const int64_t* pairs, uint32_t n)
+{
+    lndpi_fb_align(fb, 8, 0);
+
+    for (uint32_t i = n; i > 0; --i)
+        lndpi_fb_push(fb, &pairs[2 * (i - 1)], 16);
+
+    lndpi_fb_push(fb, &n, 4);
+
+    return fb->size;
+}
+
+static uint32_t lndpi_fb_table(struct lndpi_fb* fb, const struct lndpi_fb_field* fields, uint32_t n)
+{
+    uint32_t positions[LNDPI_FB_MAX_FIELDS] = { 0 };
+    uint16_t vtable[LNDPI_FB_MAX_FIELDS + 2];
+    uint16_t entries_number = 0;
+    size_t table_end = fb->size;
+
+    /* Push fields from the largest to keep them aligned without gaps */
+    for (uint8_t size = 8; size > 0; size /= 2)
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            if (fields[i].size != size)
+                continue;
+
+            if (fields[i].is_offset)
+                lndpi_fb_push_uoffset(fb, fields[i].value);
+            else
+            {
+                lndpi_fb_align(fb, size, 0);
+                lndpi_fb_push(fb, &fields[i].value, size);
+            }
+
+            positions[fields[i].id] = fb->size;
+
+            if (fields[i].id + 1 > entries_number)
+                entries_number = fields[i].id + 1;
+        }
+
+    int32_t soffset = 0;
+
+    lndpi_fb_align(fb, 4, 0);
+    lndpi_fb_push(fb, &soffset, 4);
+
+    uint32_t table_pos = fb->size;
+
+    vtable[0] = 4 + 2 * entries_number;
+    vtable[1] = table_pos - table_end;
+    for (uint16_t id = 0; id < entries_number; ++id)
+        vtable[2 + id] = positions[id] != 0 ? table_pos - positions[id] : 0;
+
+    lndpi_fb_push(fb, vtable, vtable[0]);
+
+    soffset = fb->size - table_pos;
+
+    if (!fb->failed)
+        memcpy(fb->buf + fb->cap - table_pos, &soffset, 4);
+
+    return table_pos;
+}
+
+static void lndpi_fb_finish(struct lndpi_fb* fb, uint32_t root)
+{
+    lndpi_fb_align(fb, 8, 4);
+    lndpi_fb_push_uoffset(fb, root);
+}
+
+/**
+ *  Build an Arrow Int type table
+ */
+static uint32_t lndpi_arrow_int(struct lndpi_fb* fb, uint8_t bit_width, uint8_t is_signed)
+{
+    struct lndpi_fb_field fields[] = {
+        { 0, 4, 0, bit_width },
+        { 1, 1, 0, is_signed }
+    };
+
+    return lndpi_fb_table(fb, fields, 2);
+}
+
+/**
+ *  Build an Arrow Field table for a column
+ */
+static uint32_t lndpi_arrow_field(
+    struct lndpi_fb* fb,
+    const struct lndpi_columnar_column* column,
+    int64_t dictionary_id,
+    uint32_t children
+) {
+    struct lndpi_fb_field fields[LNDPI_FB_MAX_FIELDS];
+    uint32_t n = 0, type, type_type;
+
+    switch (column->type) {
+        case LNDPI_COLUMN_TIMESTAMP:
+        {
+            struct lndpi_fb_field unit = { 0, 2, 0, LNDPI_ARROW_TIME_UNIT_MILLISECOND };
+
+            type = lndpi_fb_table(fb, &unit, 1);
+            type_type = LNDPI_ARROW_TYPE_TIMESTAMP;
+            break;
+        }
+        case LNDPI_COLUMN_PROTOCOL:
+        {
+            uint32_t index_type = lndpi_arrow_int(fb, column->bit_width, 1);
+            struct lndpi_fb_field encoding[] = {
+                { 0, 8, 0, (uint64_t)dictionary_id },
+                { 1, 4, 1, index_type }
+            };
+
+            fields[n++] = (struct lndpi_fb_field){ 4, 4, 1, lndpi_fb_table(fb, encoding, 2) };
+
+            type = lndpi_fb_table(fb, NULL, 0);
+            type_type = LNDPI_ARROW_TYPE_UTF8;
+            break;
+        }
+        case LNDPI_COLUMN_BOOL:
+            type = lndpi_fb_table(fb, NULL, 0);
+            type_type = LNDPI_ARROW_TYPE_BOOL;
+            break;
+        default:
+            type = lndpi_arrow_int(fb, column->bit_width, 0);
+            type_type = LNDPI_ARROW_TYPE_INT;
+    }
+
+    fields[n++] = (struct lndpi_fb_field){ 0, 4, 1, lndpi_fb_string(fb, column->name) };
+    fields[n++] = (struct lndpi_fb_field){ 1, 1, 0, 0 };
+    fields[n++] = (struct lndpi_fb_field){ 2, 1, 0, type_type };
+    fields[n++] = (struct lndpi_fb_field){ 3, 4, 1, type };
+    fields[n++] = (struct lndpi_fb_field){ 5, 4, 1, children };
+
+    return lndpi_fb_table(fb, fields, n);
+}
+
+/**
+ *  Build an Arrow Message table and finish the buffer
+ */
+static void lndpi_arrow_message(struct lndpi_fb* fb, uint8_t header_type, uint32_t header, int64_t body_length)
+{
+    struct lndpi_fb_field fields[] = {
+        { 0, 2, 0, LNDPI_ARROW_METADATA_V5 },
+        { 1, 1, 0, header_type },
+        { 2, 4, 1, header },
+        { 3, 8, 0, (uint64_t)body_length }
+    };
+
+    lndpi_fb_finish(fb, lndpi_fb_table(fb, fields, 4));
+}
+
+/**
+ *  Build an Arrow RecordBatch table
+ */
+static uint32_t lndpi_arrow_record_batch(
+    struct lndpi_fb* fb,
+    int64_t length,
+    const int64_t* nodes,
+    uint32_t nodes_number,
+    const int64_t* buffers,
+    uint32_t buffers_number
+) {
+    uint32_t buffers_vector = lndpi_fb_pair_vector(fb, buffers, buffers_number);
+    uint32_t nodes_vector = lndpi_fb_pair_vector(fb, nodes, nodes_number);
+
+    struct lndpi_fb_field fields[] = {
+        { 0, 8, 0, (uint64_t)length },
+        { 1, 4, 1, nodes_vector },
+        { 2, 4, 1, buffers_vector }
+    };
+
+    return lndpi_fb_table(fb, fields, 3);
+}
+
+static size_t lndpi_pad8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+/**
+ *  Write a message: continuation marker, metadata size, metadata
+ */
+static uint8_t lndpi_columnar_write_metadata(struct lndpi_columnar_sink* sink, struct lndpi_fb* fb)
+{
+    uint32_t prefix[2] = { LNDPI_ARROW_CONTINUATION, fb->size };
+
+    if (fb->failed
+        || fwrite(prefix, sizeof(prefix), 1, sink->file) != 1
+        || fwrite(fb->buf + fb->cap - fb->size, fb->size, 1, sink->file) != 1)
+        return 0;
+
+    sink->file_bytes += sizeof(prefix) + fb->size;
+
+    return 1;
+}
+
+/**
+ *  Write a body buffer padded to 8 bytes
+ */
+static uint8_t lndpi_columnar_write_buffer(struct lndpi_columnar_sink* sink, const void* data, size_t size)
+{
+    static const uint8_t zeros[8] = { 0 };
+    size_t padded = lndpi_pad8(size);
+
+    if ((size > 0 && fwrite(data, size, 1, sink->file) != 1)
+        || (padded > size && fwrite(zeros, padded - size, 1, sink->file) != 1))
+        return 0;
+
+    sink->file_bytes += padded;
+
+    return 1;
+}
+
+static size_t lndpi_columnar_column_size(const struct lndpi_columnar_column* column, uint32_t rows)
+{
+    return column->bit_width == 0 ? (rows + 7) / 8 : (size_t)rows * column->bit_width / 8;
+}
+
+/**
+ *  Write the schema message
+ */
+static enum lndpi_error lndpi_columnar_write_schema(struct lndpi_columnar_sink* sink)
+{
+    struct lndpi_fb fb;
+    uint32_t fields[LNDPI_COLUMNS_NUMBER];
+    int64_t dictionary_id = 0;
+
+    lndpi_fb_init(&fb);
+
+    uint32_t children = lndpi_fb_offset_vector(&fb, NULL, 0);
+
+    for (uint32_t i = 0; i < LNDPI_COLUMNS_NUMBER; ++i)
+        fields[i] = lndpi_arrow_field(
+            &fb,
+            &s_columns[i],
+            s_columns[i].type == LNDPI_COLUMN_PROTOCOL ? dictionary_id++ : -1,
+            children
+        );
+
+    struct lndpi_fb_field schema[] = {
+        { 0, 2, 0, 0 },
+        { 1, 4, 1, lndpi_fb_offset_vector(&fb, fields, LNDPI_COLUMNS_NUMBER) }
+    };
+
+    lndpi_arrow_message(&fb, LNDPI_ARROW_HEADER_SCHEMA, lndpi_fb_table(&fb, schema, 2), 0);
+
+    uint8_t written = lndpi_columnar_write_metadata(sink, &fb);
+
+    free(fb.buf);
+
+    return written ? LNDPI_OK : LNDPI_CANT_WRITE_TO_OUTPUT_FILE;
+}
+
+/**
+ *  Write protocol names dictionary batch
+ */
+static enum lndpi_error lndpi_columnar_write_dictionary(struct lndpi_columnar_sink* sink, int64_t dictionary_id)
+{
+    struct lndpi_fb fb;
+
+    size_t offsets_size = (sink->dictionary_size + 1) * sizeof(int32_t);
+    size_t data_size = sink->dictionary_offsets[sink->dictionary_size];
+
+    int64_t nodes[] = { sink->dictionary_size, 0 };
+    int64_t buffers[] = {
+        0, 0,
+        0, offsets_size,
+        lndpi_pad8(offsets_size), data_size
+    };
+
+    lndpi_fb_init(&fb);
+
+    uint32_t data = lndpi_arrow_record_batch(&fb, sink->dictionary_size, nodes, 1, buffers, 3);
+
+    struct lndpi_fb_field dictionary[] = {
+        { 0, 8, 0, (uint64_t)dictionary_id },
+        { 1, 4, 1, data }
+    };
+
+    lndpi_arrow_message(
+        &fb,
+        LNDPI_ARROW_HEADER_DICTIONARY_BATCH,
+        lndpi_fb_table(&fb, dictionary, 2),
+        lndpi_pad8(offsets_size) + lndpi_pad8(data_size)
+    );
+
+    uint8_t written = lndpi_columnar_write_metadata(sink, &fb)
+        && lndpi_columnar_write_buffer(sink, sink->dictionary_offsets, offsets_size)
+        && lndpi_columnar_write_buffer(sink, sink->dictionary_data, data_size);
+
+    free(fb.buf);
+
+    return written ? LNDPI_OK : LNDPI_CANT_WRITE_TO_OUTPUT_FILE;
+}
+
+/**
+ *  Write a record batch
+ */
+static enum lndpi_error lndpi_columnar_write_record_batch(
+    struct lndpi_columnar_sink* sink,
+    const struct lndpi_columnar_batch* batch
+) {
+    struct lndpi_fb fb;
+    int64_t nodes[2 * LNDPI_COLUMNS_NUMBER], buffers[4 * LNDPI_COLUMNS_NUMBER];
+    int64_t body_length = 0;
+
+    for (uint32_t i = 0; i < LNDPI_COLUMNS_NUMBER; ++i)
+    {
+        size_t size = lndpi_columnar_column_size(&s_columns[i], batch->rows);
+
+        nodes[2 * i] = batch->rows;
+        nodes[2 * i + 1] = 0;
+
+        /* Validity bitmap is omitted since columns have no nulls */
+        buffers[4 * i] = body_length;
+        buffers[4 * i + 1] = 0;
+        buffers[4 * i + 2] = body_length;
+        buffers[4 * i + 3] = size;
+
+        body_length += lndpi_pad8(size);
+    }
+
+    lndpi_fb_init(&fb);
+
+    uint32_t record_batch = lndpi_arrow_record_batch(
+        &fb,
+        batch->rows,
+        nodes,
+        LNDPI_COLUMNS_NUMBER,
+        buffers,
+        2 * LNDPI_COLUMNS_NUMBER
+    );
+
+    lndpi_arrow_message(&fb, LNDPI_ARROW_HEADER_RECORD_BATCH, record_batch, body_length);
+
+    uint8_t written = lndpi_columnar_write_metadata(sink, &fb);
+
+    free(fb.buf);
+
+    for (uint32_t i = 0; written && i < LNDPI_COLUMNS_NUMBER; ++i)
+        written = lndpi_columnar_write_buffer(
+            sink,
+            (const uint8_t*)batch + s_columns[i].offset,
+            lndpi_columnar_column_size(&s_columns[i], batch->rows)
+        );
+
+    return written ? LNDPI_OK : LNDPI_CANT_WRITE_TO_OUTPUT_FILE;
+}
+
+/**
+ *  Write end of stream marker and close the current file
+ */
+static enum lndpi_error lndpi_columnar_close_file(struct lndpi_columnar_sink* sink)
+{
+    uint32_t eos[2] = { LNDPI_ARROW_CONTINUATION, 0 };
+    uint8_t written = fwrite(eos, sizeof(eos), 1, sink->file) == 1;
+
+    if (fclose(sink->file) != 0)
+        written = 0;
+
+    sink->file = NULL;
+
+    return written ? LNDPI_OK : LNDPI_CANT_WRITE_TO_OUTPUT_FILE;
+}
+
+/**
+ *  Start a new file with the schema and protocol dictionaries
+ */
+static enum lndpi_error lndpi_columnar_open_file(struct lndpi_columnar_sink* sink, uint64_t now_ms)
+{
+    enum lndpi_error error;
+    char path[320];
+
+    snprintf(path, sizeof(path), "%s-%llu-%u.arrows",
+        sink->path_prefix, (unsigned long long)now_ms, sink->file_index++);
+
+    if ((sink->file = fopen(path, "wb")) == NULL)
+        return LNDPI_CANT_OPEN_OUTPUT_FILE;
+
+    sink->file_bytes = 0;
+    sink->file_opened_ms = now_ms;
+
+    if ((error = lndpi_columnar_write_schema(sink)) != LNDPI_OK)
+        return error;
+
+    for (int64_t id = 0; id < 2; ++id)
+        if ((error = lndpi_columnar_write_dictionary(sink, id)) != LNDPI_OK)
+            return error;
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Write a batch rotating the file if needed
+ */
+static enum lndpi_error lndpi_columnar_write_batch(
+    struct lndpi_columnar_sink* sink,
+    const struct lndpi_columnar_batch* batch
+) {
+    enum lndpi_error error;
+
+    uint64_t now_ms = lndpi_current_time_ms();
+
+    if (sink->file != NULL
+        && ((sink->rotate_bytes > 0 && sink->file_bytes >= sink->rotate_bytes)
+            || (sink->rotate_ms > 0 && now_ms - sink->file_opened_ms >= sink->rotate_ms))
+        && (error = lndpi_columnar_close_file(sink)) != LNDPI_OK)
+        return error;
+
+    if (sink->file == NULL && (error = lndpi_columnar_open_file(sink, now_ms)) != LNDPI_OK)
+        return error;
+
+    return lndpi_columnar_write_record_batch(sink, batch);
+}
+
+/**
+ *  Writer thread
+ *  After an error batches are returned to the free list without writing
+ */
+static void* lndpi_columnar_sink_thread(void* parameter)
+{
+    struct lndpi_columnar_sink* sink = (struct lndpi_columnar_sink*)parameter;
+    struct lndpi_columnar_batch* batch;
+    enum lndpi_error error;
+
+    pthread_mutex_lock(&sink->mutex);
+
+    for (;;)
+    {
+        while (sink->queue_head == NULL && !sink->stop)
+            pthread_cond_wait(&sink->queued_cond, &sink->mutex);
+
+        if ((batch = sink->queue_head) == NULL)
+            break;
+
+        if ((sink->queue_head = batch->next) == NULL)
+            sink->queue_tail = NULL;
+
+        uint8_t failed = sink->error != LNDPI_OK;
+
+        pthread_mutex_unlock(&sink->mutex);
+
+        error = failed ? LNDPI_OK : lndpi_columnar_write_batch(sink, batch);
+
+        pthread_mutex_lock(&sink->mutex);
+
+        if (error != LNDPI_OK)
+            __atomic_store_n(&sink->error, error, __ATOMIC_RELAXED);
+
+        batch->rows = 0;
+        batch->next = sink->free_batches;
+        sink->free_batches = batch;
+
+        pthread_cond_signal(&sink->free_cond);
+    }
+
+    pthread_mutex_unlock(&sink->mutex);
+
+    if (sink->file != NULL
+        && (error = lndpi_columnar_close_file(sink)) != LNDPI_OK
+        && sink->error == LNDPI_OK)
+        sink->error = error;
+
+    return NULL;
+}
+
+/**
+ *  Pass the current batch to the writer thread and take a free one
+ */
+static enum lndpi_error lndpi_columnar_sink_submit(struct lndpi_columnar_sink* sink)
+{
+    pthread_mutex_lock(&sink->mutex);
+
+    sink->current->next = NULL;
+
+    if (sink->queue_tail != NULL)
+        sink->queue_tail->next = sink->current;
+    else
+        sink->queue_head = sink->current;
+    sink->queue_tail = sink->current;
+
+    pthread_cond_signal(&sink->queued_cond);
+
+    while (sink->free_batches == NULL)
+        pthread_cond_wait(&sink->free_cond, &sink->mutex);
+
+    sink->current = sink->free_batches;
+    sink->free_batches = sink->current->next;
+
+    enum lndpi_error error = sink->error;
+
+    pthread_mutex_unlock(&sink->mutex);
+
+    return error;
+}
+
+/**
+ *  Collect protocol names for dictionary batches
+ */
+static enum lndpi_error lndpi_columnar_build_dictionary(
+    struct lndpi_columnar_sink* sink,
+    struct ndpi_detection_module_struct* ndpi_struct
+) {
+    uint32_t size = ndpi_get_num_supported_protocols(ndpi_struct);
+    size_t data_size = 0;
+
+    if ((sink->dictionary_offsets = (int32_t*)ndpi_malloc((size + 1) * sizeof(int32_t))) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+
+    for (uint32_t id = 0; id < size; ++id)
+        data_size += strlen(ndpi_get_proto_name(ndpi_struct, id));
+
+    /* Offsets mark the dictionary as built, so they are dropped to retry on the next record */
+    if ((sink->dictionary_data = (char*)ndpi_malloc(data_size + 1)) == NULL)
+    {
+        ndpi_free(sink->dictionary_offsets);
+        sink->dictionary_offsets = NULL;
+
+        return LNDPI_OUT_OF_MEMORY;
+    }
+
+    data_size = 0;
+
+    for (uint32_t id = 0; id < size; ++id)
+    {
+        const char* name = ndpi_get_proto_name(ndpi_struct, id);
+        size_t len = strlen(name);
+
+        sink->dictionary_offsets[id] = data_size;
+        memcpy(sink->dictionary_data + data_size, name, len);
+        data_size += len;
+    }
+
+    sink->dictionary_offsets[size] = data_size;
+    sink->dictionary_size = size;
+
+    return LNDPI_OK;
+}
+
+static int16_t lndpi_columnar_protocol_index(struct lndpi_columnar_sink* sink, uint16_t protocol)
+{
+    return protocol < sink->dictionary_size ? (int16_t)protocol : NDPI_PROTOCOL_UNKNOWN;
+}
+
+/**
+ *  Append a record to the current batch
+ */
+static enum lndpi_error lndpi_columnar_sink_append(
+    struct lndpi_columnar_sink* sink,
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow,
+    uint8_t reversed,
+    uint64_t time_ms,
+    uint16_t length
+) {
+    enum lndpi_error error;
+
+    if ((error = __atomic_load_n(&sink->error, __ATOMIC_RELAXED)) != LNDPI_OK)
+        return error;
+
+    if (sink->dictionary_offsets == NULL
+        && (error = lndpi_columnar_build_dictionary(sink, ndpi_struct)) != LNDPI_OK)
+        return error;
+
+    struct lndpi_columnar_batch* batch = sink->current;
+    uint32_t row = batch->rows++;
+
+    batch->flow_id[row] = flow->id;
+    batch->time_ms[row] = time_ms;
+    batch->src_addr[row] = ntohl(reversed ? flow->dst_addr.s_addr : flow->src_addr.s_addr);
+    batch->dst_addr[row] = ntohl(reversed ? flow->src_addr.s_addr : flow->dst_addr.s_addr);
+    batch->src_port[row] = reversed ? flow->dst_port : flow->src_port;
+    batch->dst_port[row] = reversed ? flow->src_port : flow->dst_port;
+    batch->length[row] = length;
+    batch->ip_protocol[row] = flow->ip_protocol;
+    batch->master_protocol[row] = lndpi_columnar_protocol_index(sink, flow->protocol.master_protocol);
+    batch->app_protocol[row] = lndpi_columnar_protocol_index(sink, flow->protocol.app_protocol);
+    batch->category[row] = flow->protocol.category;
+
+    if (flow->protocol_was_guessed)
+        batch->guessed[row / 8] |= 1 << (row % 8);
+    else
+        batch->guessed[row / 8] &= ~(1 << (row % 8));
+
+    if (batch->rows == LNDPI_COLUMNAR_BATCH_ROWS)
+        return lndpi_columnar_sink_submit(sink);
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_columnar_sink_open(
+    struct lndpi_columnar_sink** sink_ptr,
+    const char* path_prefix,
+    uint64_t rotate_bytes,
+    uint64_t rotate_ms
+) {
+    struct lndpi_columnar_sink* sink;
+
+    if (strlen(path_prefix) >= sizeof(sink->path_prefix))
+        return LNDPI_CANT_OPEN_OUTPUT_FILE;
+
+    if ((sink = (struct lndpi_columnar_sink*)ndpi_calloc(1, sizeof(struct lndpi_columnar_sink))) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+
+    strcpy(sink->path_prefix, path_prefix);
+    sink->rotate_bytes = rotate_bytes;
+    sink->rotate_ms = rotate_ms;
+
+    for (int i = 0; i < LNDPI_COLUMNAR_BATCHES; ++i)
+    {
+        struct lndpi_columnar_batch* batch;
+
+        if ((batch = (struct lndpi_columnar_batch*)ndpi_calloc(1, sizeof(struct lndpi_columnar_batch))) == NULL)
+        {
+            lndpi_columnar_sink_close(sink);
+
+            return LNDPI_OUT_OF_MEMORY;
+        }
+
+        batch->next = sink->free_batches;
+        sink->free_batches = batch;
+    }
+
+    sink->current = sink->free_batches;
+    sink->free_batches = sink->current->next;
+
+    pthread_mutex_init(&sink->mutex, NULL);
+    pthread_cond_init(&sink->queued_cond, NULL);
+    pthread_cond_init(&sink->free_cond, NULL);
+
+    if (pthread_create(&sink->thread, NULL, lndpi_columnar_sink_thread, sink) != 0)
+    {
+        pthread_mutex_destroy(&sink->mutex);
+        pthread_cond_destroy(&sink->queued_cond);
+        pthread_cond_destroy(&sink->free_cond);
+
+        sink->current->next = sink->free_batches;
+        sink->free_batches = sink->current;
+        sink->current = NULL;
+
+        lndpi_columnar_sink_close(sink);
+
+        return LNDPI_OUT_OF_MEMORY;
+    }
+
+    *sink_ptr = sink;
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_columnar_sink_flush(struct lndpi_columnar_sink* sink)
+{
+    if (sink->current->rows == 0)
+        return __atomic_load_n(&sink->error, __ATOMIC_RELAXED);
+
+    return lndpi_columnar_sink_submit(sink);
+}
+
+enum lndpi_error lndpi_columnar_sink_close(struct lndpi_columnar_sink* sink)
+{
+    struct lndpi_columnar_batch* batch;
+    enum lndpi_error error = LNDPI_OK;
+
+    /* Sink is closed by a failed open if there is no current batch */
+    if (sink->current != NULL)
+    {
+        pthread_mutex_lock(&sink->mutex);
+
+        if (sink->current->rows > 0)
+        {
+            sink->current->next = NULL;
+
+            if (sink->queue_tail != NULL)
+                sink->queue_tail->next = sink->current;
+            else
+                sink->queue_head = sink->current;
+            sink->queue_tail = sink->current;
+        } else
+        {
+            sink->current->next = sink->free_batches;
+            sink->free_batches = sink->current;
+        }
+
+        sink->stop = 1;
+
+        pthread_cond_signal(&sink->queued_cond);
+        pthread_mutex_unlock(&sink->mutex);
+
+        pthread_join(sink->thread, NULL);
+
+        pthread_mutex_destroy(&sink->mutex);
+        pthread_cond_destroy(&sink->queued_cond);
+        pthread_cond_destroy(&sink->free_cond);
+
+        error = sink->error;
+    }
+
+    while ((batch = sink->free_batches) != NULL)
+    {
+        sink->free_batches = batch->next;
+        ndpi_free(batch);
+    }
+
+    ndpi_free(sink->dictionary_offsets);
+    ndpi_free(sink->dictionary_data);
+    ndpi_free(sink);
+
+    return error;
+}
+
+enum lndpi_error lndpi_columnar_sink_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+) {
+    return lndpi_columnar_sink_append(
+        (struct lndpi_columnar_sink*)parameter,
+        ndpi_struct,
+        packet->lndpi_flow,
+        packet->direction != 1,
+        packet->time_ms,
+        packet->length
+    );
+}
+
+enum lndpi_error lndpi_columnar_sink_flow_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow,
+    void* parameter
+) {
+    return lndpi_columnar_sink_append(
+        (struct lndpi_columnar_sink*)parameter,
+        ndpi_struct,
+        flow,
+        0,
+        flow->last_packet_ms,
+        0
+    );
+}
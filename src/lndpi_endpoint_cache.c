@@ -0,0 +1,124 @@
+#include "lndpi_endpoint_cache.h"
+
+#include <string.h>
+
+enum lndpi_error lndpi_endpoint_cache_init(
+    struct lndpi_endpoint_cache* cache,
+    uint32_t size,
+    uint64_t ttl_ms
+) {
+    uint32_t sets_number = 1;
+
+    while (sets_number * LNDPI_ENDPOINT_CACHE_WAYS < size && sets_number < (1u << 28))
+        sets_number <<= 1;
+
+    size_t entries_size = (size_t)sets_number * LNDPI_ENDPOINT_CACHE_WAYS * sizeof(struct lndpi_endpoint_cache_entry);
+
+    if ((cache->entries = (struct lndpi_endpoint_cache_entry*)ndpi_malloc(entries_size)) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+    memset(cache->entries, 0, entries_size);
+
+    cache->sets_mask = sets_number - 1;
+    cache->ttl_ms = ttl_ms;
+
+    return LNDPI_OK;
+}
+
+void lndpi_endpoint_cache_exit(struct lndpi_endpoint_cache* cache)
+{
+    ndpi_free(cache->entries);
+
+    cache->entries = NULL;
+}
+
+static struct lndpi_endpoint_cache_entry* lndpi_endpoint_cache_set(
+    struct lndpi_endpoint_cache* cache,
+    struct in_addr addr,
+    uint16_t port,
+    uint8_t ip_protocol
+) {
+    uint32_t hash = lndpi_packet_flow_hash(addr, addr, port, ((uint16_t)ip_protocol << 8) | ip_protocol);
+
+    return &cache->entries[(hash & cache->sets_mask) * LNDPI_ENDPOINT_CACHE_WAYS];
+}
+
+static uint8_t lndpi_endpoint_cache_entry_match(
+    struct lndpi_endpoint_cache_entry* entry,
+    struct in_addr addr,
+    uint16_t port,
+    uint8_t ip_protocol
+) {
+    return entry->valid
+        && entry->addr.s_addr == addr.s_addr
+        && entry->port == port
+        && entry->ip_protocol == ip_protocol;
+}
+
+uint8_t lndpi_endpoint_cache_find(
+    struct lndpi_endpoint_cache* cache,
+    struct in_addr addr,
+    uint16_t port,
+    uint8_t ip_protocol,
+    uint64_t now_ms,
+    ndpi_protocol* protocol
+) {
+    struct lndpi_endpoint_cache_entry* set = lndpi_endpoint_cache_set(cache, addr, port, ip_protocol);
+    uint32_t i;
+
+    for (i = 0; i < LNDPI_ENDPOINT_CACHE_WAYS; ++i)
+    {
+        if (!lndpi_endpoint_cache_entry_match(&set[i], addr, port, ip_protocol))
+            continue;
+
+        if (now_ms - set[i].inserted_ms > cache->ttl_ms)
+        {
+            set[i].valid = 0;
+
+            return 0;
+        }
+
+        *protocol = set[i].protocol;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void lndpi_endpoint_cache_put(
+    struct lndpi_endpoint_cache* cache,
+    struct in_addr addr,
+    uint16_t port,
+    uint8_t ip_protocol,
+    uint64_t now_ms,
+    ndpi_protocol protocol
+) {
+    struct lndpi_endpoint_cache_entry* set = lndpi_endpoint_cache_set(cache, addr, port, ip_protocol);
+    struct lndpi_endpoint_cache_entry* entry = NULL;
+    uint32_t i;
+
+    for (i = 0; i < LNDPI_ENDPOINT_CACHE_WAYS && entry == NULL; ++i)
+        if (lndpi_endpoint_cache_entry_match(&set[i], addr, port, ip_protocol))
+            entry = &set[i];
+
+    /* Take a free entry or replace the oldest one */
+    for (i = 0; i < LNDPI_ENDPOINT_CACHE_WAYS && entry == NULL; ++i)
+        if (!set[i].valid)
+            entry = &set[i];
+
+    if (entry == NULL)
+    {
+        entry = &set[0];
+
+        for (i = 1; i < LNDPI_ENDPOINT_CACHE_WAYS; ++i)
+            if (set[i].inserted_ms < entry->inserted_ms)
+                entry = &set[i];
+    }
+
+    entry->inserted_ms = now_ms;
+    entry->addr = addr;
+    entry->port = port;
+    entry->ip_protocol = ip_protocol;
+    entry->valid = 1;
+    entry->protocol = protocol;
+}
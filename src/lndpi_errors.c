@@ -20,12 +20,51 @@ char* lndpi_error_to_string(enum lndpi_error error, char* str_buffer)
         case LNDPI_CANT_OPEN_LOG_FILE:
             strcpy(str_buffer, "Can't open log file");
             break;
+        case LNDPI_CANT_WRITE_TO_LOG_FILE:
+            strcpy(str_buffer, "Can't write to log file");
+            break;
         case LNDPI_NDPI_MODULE_INIT_ERROR:
             strcpy(str_buffer, "ndpi_detection_module_struct can't be initialized");
             break;
         case LNDPI_IPV6_NOT_SUPPORTED:
             strcpy(str_buffer, "IPv6 is not supported yet");
             break;
+        case LNDPI_CANT_OPEN_SNAPSHOT_FILE:
+            strcpy(str_buffer, "Can't open snapshot file");
+            break;
+        case LNDPI_CANT_WRITE_TO_SNAPSHOT_FILE:
+            strcpy(str_buffer, "Can't write to snapshot file");
+            break;
+        case LNDPI_INVALID_SNAPSHOT_FILE:
+            strcpy(str_buffer, "Invalid snapshot file");
+            break;
+        case LNDPI_CANT_LOAD_PROTOCOLS_FILE:
+            strcpy(str_buffer, "Can't load protocols file");
+            break;
+        case LNDPI_CANT_LOAD_CATEGORIES_FILE:
+            strcpy(str_buffer, "Can't load categories file");
+            break;
+        case LNDPI_CANT_BIND_NUMA_NODE:
+            strcpy(str_buffer, "Can't bind to NUMA node");
+            break;
+        case LNDPI_CANT_OPEN_RESULT_RING:
+            strcpy(str_buffer, "Can't open result ring");
+            break;
+        case LNDPI_INVALID_RESULT_RING:
+            strcpy(str_buffer, "Invalid result ring");
+            break;
+        case LNDPI_CANT_OPEN_OUTPUT_FILE:
+            strcpy(str_buffer, "Can't open output file");
+            break;
+        case LNDPI_CANT_WRITE_TO_OUTPUT_FILE:
+            strcpy(str_buffer, "Can't write to output file");
+            break;
+        case LNDPI_MALFORMED_PACKET:
+            strcpy(str_buffer, "Malformed packet");
+            break;
+        case LNDPI_NON_IP_PACKET:
+            strcpy(str_buffer, "Not an IP packet");
+            break;
         default:
             strcpy(str_buffer, "Unknown error");
     }
@@ -0,0 +1,272 @@
+#include "lndpi_flow_query.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum lndpi_error lndpi_flow_query_init(struct lndpi_flow_query_table* table, uint32_t size)
+{
+    uint32_t buckets_number = 2;
+
+    while ((uint64_t)buckets_number * LNDPI_FLOW_QUERY_WAYS < (uint64_t)size * LNDPI_FLOW_QUERY_HEADROOM
+        && buckets_number < (1u << 26))
+        buckets_number <<= 1;
+
+    size_t buckets_size = (size_t)buckets_number * sizeof(struct lndpi_flow_query_bucket);
+
+    table->overflows = 0;
+    table->read_retries = 0;
+
+    if (posix_memalign((void**)&table->buckets, 64, buckets_size) != 0)
+    {
+        table->buckets = NULL;
+
+        return LNDPI_OUT_OF_MEMORY;
+    }
+    memset(table->buckets, 0, buckets_size);
+
+    table->buckets_mask = buckets_number - 1;
+
+    return LNDPI_OK;
+}
+
+void lndpi_flow_query_exit(struct lndpi_flow_query_table* table)
+{
+    free(table->buckets);
+
+    table->buckets = NULL;
+    table->buckets_mask = 0;
+}
+
+/**
+ *  Start an update of a bucket; readers retry until it is finished
+ */
+static void lndpi_flow_query_write_begin(struct lndpi_flow_query_bucket* bucket)
+{
+    __atomic_store_n(&bucket->seq, bucket->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void lndpi_flow_query_write_end(struct lndpi_flow_query_bucket* bucket)
+{
+    __atomic_store_n(&bucket->seq, bucket->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline void lndpi_flow_query_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ *  Copy a bucket which is not being updated
+ *  Waits for a running update and copies discarded because of an update are counted as retries
+ */
+static void lndpi_flow_query_read_bucket(
+    struct lndpi_flow_query_table* table,
+    struct lndpi_flow_query_bucket* bucket,
+    struct lndpi_flow_query_bucket* copy
+) {
+    uint32_t seq, retries = 0;
+
+    for (;;)
+    {
+        if ((seq = __atomic_load_n(&bucket->seq, __ATOMIC_ACQUIRE)) & 1)
+        {
+            ++retries;
+
+            while ((seq = __atomic_load_n(&bucket->seq, __ATOMIC_ACQUIRE)) & 1)
+                lndpi_flow_query_cpu_relax();
+        }
+
+        memcpy(copy, bucket, sizeof(struct lndpi_flow_query_bucket));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&bucket->seq, __ATOMIC_RELAXED) == seq)
+            break;
+
+        ++retries;
+    }
+
+    if (retries > 0)
+        __atomic_fetch_add(&table->read_retries, retries, __ATOMIC_RELAXED);
+}
+
+/**
+ *  Find a free way of a bucket
+ *
+ *  @return index of the way; LNDPI_FLOW_QUERY_WAYS if the bucket is full
+ */
+static uint8_t lndpi_flow_query_free_way(struct lndpi_flow_query_bucket* bucket)
+{
+    uint8_t way;
+
+    for (way = 0; way < LNDPI_FLOW_QUERY_WAYS && bucket->used[way]; ++way)
+        ;
+
+    return way;
+}
+
+void lndpi_flow_query_publish(struct lndpi_flow_query_table* table, struct lndpi_packet_flow* flow)
+{
+    struct lndpi_flow_query_bucket* bucket = flow->query_bucket;
+    uint8_t way = flow->query_way;
+
+    if (bucket == NULL)
+    {
+        uint32_t index = flow->hash & table->buckets_mask;
+
+        bucket = &table->buckets[index];
+
+        if ((way = lndpi_flow_query_free_way(bucket)) == LNDPI_FLOW_QUERY_WAYS)
+        {
+            bucket = &table->buckets[index ^ 1];
+
+            if ((way = lndpi_flow_query_free_way(bucket)) == LNDPI_FLOW_QUERY_WAYS)
+            {
+                ++table->overflows;
+
+                return;
+            }
+        }
+
+        flow->query_bucket = bucket;
+        flow->query_way = way;
+    }
+
+    struct lndpi_flow_info* info = &bucket->flows[way];
+
+    lndpi_flow_query_write_begin(bucket);
+
+    __atomic_store_n(&bucket->used[way], 1, __ATOMIC_RELAXED);
+
+    info->id = flow->id;
+    info->src_addr = flow->src_addr;
+    info->dst_addr = flow->dst_addr;
+    info->src_port = flow->src_port;
+    info->dst_port = flow->dst_port;
+    info->master_protocol = flow->protocol.master_protocol;
+    info->app_protocol = flow->protocol.app_protocol;
+    info->category = flow->protocol.category;
+    info->ip_protocol = flow->ip_protocol;
+    info->detection_finished = lndpi_packet_flow_detection_finished(flow);
+    info->protocol_was_guessed = flow->protocol_was_guessed;
+    info->tcp_state = flow->tcp_state;
+    info->packets_num = flow->packets_num;
+    info->bytes_num = flow->bytes_num;
+    info->last_packet_ms = flow->last_packet_ms;
+
+    lndpi_flow_query_write_end(bucket);
+}
+
+void lndpi_flow_query_remove(struct lndpi_packet_flow* flow)
+{
+    struct lndpi_flow_query_bucket* bucket = flow->query_bucket;
+
+    if (bucket == NULL)
+        return;
+
+    lndpi_flow_query_write_begin(bucket);
+
+    __atomic_store_n(&bucket->used[flow->query_way], 0, __ATOMIC_RELAXED);
+
+    lndpi_flow_query_write_end(bucket);
+
+    flow->query_bucket = NULL;
+}
+
+/**
+ *  Find a flow by addresses in any direction in a copy of a bucket
+ *
+ *  @return pointer to the flow in the copy; NULL if it was not found
+ */
+static struct lndpi_flow_info* lndpi_flow_query_find(
+    struct lndpi_flow_query_bucket* copy,
+    struct in_addr src_addr,
+    struct in_addr dst_addr,
+    uint16_t src_port,
+    uint16_t dst_port,
+    uint8_t ip_protocol
+) {
+    uint8_t way;
+
+    for (way = 0; way < LNDPI_FLOW_QUERY_WAYS; ++way)
+    {
+        struct lndpi_flow_info* flow = &copy->flows[way];
+
+        if (!copy->used[way] || flow->ip_protocol != ip_protocol)
+            continue;
+
+        if ((flow->src_addr.s_addr == src_addr.s_addr
+                && flow->dst_addr.s_addr == dst_addr.s_addr
+                && flow->src_port == src_port
+                && flow->dst_port == dst_port)
+            || (flow->src_addr.s_addr == dst_addr.s_addr
+                && flow->dst_addr.s_addr == src_addr.s_addr
+                && flow->src_port == dst_port
+                && flow->dst_port == src_port))
+            return flow;
+    }
+
+    return NULL;
+}
+
+uint8_t lndpi_flow_query_lookup(
+    struct lndpi_flow_query_table* table,
+    struct in_addr src_addr,
+    struct in_addr dst_addr,
+    uint16_t src_port,
+    uint16_t dst_port,
+    uint8_t ip_protocol,
+    struct lndpi_flow_info* info
+) {
+    struct lndpi_flow_query_bucket copy;
+    struct lndpi_flow_info* flow;
+    uint32_t index = lndpi_packet_flow_hash(src_addr, dst_addr, src_port, dst_port) & table->buckets_mask;
+    uint8_t i;
+
+    /* Flow is in its own bucket or, if that was full, in the neighbour one */
+    for (i = 0; i < 2; ++i, index ^= 1)
+    {
+        lndpi_flow_query_read_bucket(table, &table->buckets[index], &copy);
+
+        if ((flow = lndpi_flow_query_find(&copy, src_addr, dst_addr, src_port, dst_port, ip_protocol)) != NULL)
+        {
+            *info = *flow;
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t lndpi_flow_query_snapshot(
+    struct lndpi_flow_query_table* table,
+    struct lndpi_flow_info* infos,
+    uint32_t max_infos
+) {
+    struct lndpi_flow_query_bucket copy;
+    uint32_t infos_num = 0, i;
+    uint8_t way;
+
+    for (i = 0; i <= table->buckets_mask && infos_num < max_infos; ++i)
+    {
+        /* Skip empty buckets without copying them */
+        for (way = 0; way < LNDPI_FLOW_QUERY_WAYS; ++way)
+            if (__atomic_load_n(&table->buckets[i].used[way], __ATOMIC_RELAXED))
+                break;
+
+        if (way == LNDPI_FLOW_QUERY_WAYS)
+            continue;
+
+        lndpi_flow_query_read_bucket(table, &table->buckets[i], &copy);
+
+        for (way = 0; way < LNDPI_FLOW_QUERY_WAYS && infos_num < max_infos; ++way)
+            if (copy.used[way])
+                infos[infos_num++] = copy.flows[way];
+    }
+
+    return infos_num;
+}
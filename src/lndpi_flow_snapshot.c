@@ -0,0 +1,213 @@
+#include "lndpi_flow_snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void lndpi_flow_snapshot_fill_record(
+    struct lndpi_flow_snapshot_record* record,
+    struct lndpi_packet_flow* flow
+) {
+    memset(record, 0, sizeof(struct lndpi_flow_snapshot_record));
+
+    record->last_packet_ms = flow->last_packet_ms;
+    record->src_addr = flow->src_addr.s_addr;
+    record->dst_addr = flow->dst_addr.s_addr;
+    record->src_port = flow->src_port;
+    record->dst_port = flow->dst_port;
+    record->master_protocol = flow->protocol.master_protocol;
+    record->app_protocol = flow->protocol.app_protocol;
+    record->category = flow->protocol.category;
+    record->processed_packets_num = flow->processed_packets_num;
+    record->ip_protocol = flow->ip_protocol;
+    record->protocol_was_guessed = flow->protocol_was_guessed;
+    record->detection_given_up = flow->detection_given_up;
+    record->tcp_state = flow->tcp_state;
+    record->packets_num = flow->packets_num;
+    record->bytes_num = flow->bytes_num;
+}
+
+static enum lndpi_error lndpi_flow_snapshot_write(
+    struct lndpi_linked_list* flow_buffer,
+    FILE* file
+) {
+    struct lndpi_flow_snapshot_header header;
+
+    header.magic = LNDPI_FLOW_SNAPSHOT_MAGIC;
+    header.version = LNDPI_FLOW_SNAPSHOT_VERSION;
+    header.record_size = sizeof(struct lndpi_flow_snapshot_record);
+    header.records_number = flow_buffer->elements_number;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return LNDPI_CANT_WRITE_TO_SNAPSHOT_FILE;
+
+    struct lndpi_linked_list_element* iter;
+    struct lndpi_flow_snapshot_record record;
+
+    for (iter = flow_buffer->head; iter != NULL; iter = iter->next)
+    {
+        lndpi_flow_snapshot_fill_record(&record, iter->data.flow);
+
+        if (fwrite(&record, sizeof(record), 1, file) != 1)
+            return LNDPI_CANT_WRITE_TO_SNAPSHOT_FILE;
+    }
+
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+        return LNDPI_CANT_WRITE_TO_SNAPSHOT_FILE;
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_flow_snapshot_save(
+    struct lndpi_linked_list* flow_buffer,
+    const char* path
+) {
+    char tmp_path[4096];
+
+    if (snprintf(&tmp_path[0], sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+        return LNDPI_CANT_OPEN_SNAPSHOT_FILE;
+
+    FILE* file;
+
+    if ((file = fopen(&tmp_path[0], "wb")) == NULL)
+        return LNDPI_CANT_OPEN_SNAPSHOT_FILE;
+
+    enum lndpi_error error = lndpi_flow_snapshot_write(flow_buffer, file);
+
+    if (fclose(file) != 0 && error == LNDPI_OK)
+        error = LNDPI_CANT_WRITE_TO_SNAPSHOT_FILE;
+
+    if (error == LNDPI_OK && rename(&tmp_path[0], path) != 0)
+        error = LNDPI_CANT_WRITE_TO_SNAPSHOT_FILE;
+
+    if (error != LNDPI_OK)
+        unlink(&tmp_path[0]);
+
+    return error;
+}
+
+static enum lndpi_error lndpi_flow_snapshot_restore_record(
+    struct lndpi_linked_list* flow_buffer,
+    const struct lndpi_flow_snapshot_record* record,
+    lndpi_flow_hibernate_t hibernate
+) {
+    struct in_addr src_addr, dst_addr;
+
+    src_addr.s_addr = record->src_addr;
+    dst_addr.s_addr = record->dst_addr;
+
+    struct lndpi_packet_flow* flow;
+
+    if ((flow = lndpi_packet_flow_init(
+        &src_addr,
+        &dst_addr,
+        record->src_port,
+        record->dst_port,
+        record->ip_protocol
+    )) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+
+    flow->last_packet_ms = record->last_packet_ms;
+    flow->protocol.master_protocol = record->master_protocol;
+    flow->protocol.app_protocol = record->app_protocol;
+    flow->protocol.category = (ndpi_protocol_category_t)record->category;
+    flow->processed_packets_num = record->processed_packets_num;
+    flow->protocol_was_guessed = record->protocol_was_guessed;
+    flow->detection_given_up = record->detection_given_up;
+    flow->tcp_state = record->tcp_state;
+    flow->packets_num = record->packets_num;
+    flow->bytes_num = record->bytes_num;
+    flow->restored = 1;
+
+    /* Restored flows are never passed to nDPI */
+    hibernate(flow);
+
+    enum lndpi_error error;
+
+    if ((error = lndpi_flow_buffer_put(flow_buffer, flow)) != LNDPI_OK)
+        lndpi_packet_flow_destroy(flow);
+
+    return error;
+}
+
+enum lndpi_error lndpi_flow_snapshot_load(
+    struct lndpi_linked_list* flow_buffer,
+    const char* path,
+    lndpi_flow_hibernate_t hibernate,
+    uint32_t* restored_flows_num
+) {
+    *restored_flows_num = 0;
+
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return errno == ENOENT ? LNDPI_OK : LNDPI_CANT_OPEN_SNAPSHOT_FILE;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+
+        return LNDPI_CANT_OPEN_SNAPSHOT_FILE;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct lndpi_flow_snapshot_header))
+    {
+        close(fd);
+
+        return LNDPI_INVALID_SNAPSHOT_FILE;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return LNDPI_CANT_OPEN_SNAPSHOT_FILE;
+
+    const struct lndpi_flow_snapshot_header* header = (const struct lndpi_flow_snapshot_header*)map;
+
+    if (header->magic != LNDPI_FLOW_SNAPSHOT_MAGIC
+        || header->version != LNDPI_FLOW_SNAPSHOT_VERSION
+        || header->record_size != sizeof(struct lndpi_flow_snapshot_record)
+        || (uint64_t)header->records_number * header->record_size
+            > (uint64_t)st.st_size - sizeof(struct lndpi_flow_snapshot_header))
+    {
+        munmap(map, st.st_size);
+
+        return LNDPI_INVALID_SNAPSHOT_FILE;
+    }
+
+    const struct lndpi_flow_snapshot_record* records =
+        (const struct lndpi_flow_snapshot_record*)(header + 1);
+
+    enum lndpi_error error = LNDPI_OK;
+    uint32_t i;
+
+    for (i = 0; i < header->records_number; ++i)
+    {
+        /* Only flows with final decision are worth restoring */
+        if (records[i].app_protocol == NDPI_PROTOCOL_UNKNOWN && !records[i].detection_given_up)
+            continue;
+
+        if ((error = lndpi_flow_snapshot_restore_record(flow_buffer, &records[i], hibernate)) != LNDPI_OK)
+        {
+            /* Restore as many flows as fit into the buffer */
+            if (error == LNDPI_FLOW_BUFFER_OVERFLOW)
+                error = LNDPI_OK;
+
+            break;
+        }
+
+        ++*restored_flows_num;
+    }
+
+    munmap(map, st.st_size);
+
+    return error;
+}
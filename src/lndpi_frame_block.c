@@ -0,0 +1,74 @@
+#include "lndpi_frame_block.h"
+
+#include "ndpi_api.h"
+
+static uint32_t s_pinned_num = 0;
+static uint32_t s_max_pinned_num = 0;
+
+struct lndpi_frame_block* lndpi_frame_block_open(struct tpacket_block_desc* desc)
+{
+    struct lndpi_frame_block* block;
+
+    if ((block = (struct lndpi_frame_block*)ndpi_malloc(sizeof(struct lndpi_frame_block))) == NULL)
+        return NULL;
+
+    block->desc = desc;
+    block->refs = 0;
+    block->closed = 0;
+
+    return block;
+}
+
+void lndpi_frame_block_release(struct tpacket_block_desc* desc)
+{
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+}
+
+void lndpi_frame_block_close(struct lndpi_frame_block* block)
+{
+    block->closed = 1;
+
+    if (block->refs == 0)
+    {
+        lndpi_frame_block_release(block->desc);
+
+        ndpi_free(block);
+
+        return;
+    }
+
+    if (++s_pinned_num > s_max_pinned_num)
+        s_max_pinned_num = s_pinned_num;
+}
+
+void lndpi_frame_block_ref(struct lndpi_frame_block* block)
+{
+    ++block->refs;
+}
+
+void lndpi_frame_block_unref(struct lndpi_frame_block* block)
+{
+    if (--block->refs == 0 && block->closed)
+    {
+        --s_pinned_num;
+
+        lndpi_frame_block_release(block->desc);
+
+        ndpi_free(block);
+    }
+}
+
+uint32_t lndpi_frame_block_pinned_num(void)
+{
+    return s_pinned_num;
+}
+
+uint32_t lndpi_frame_block_max_pinned_num(void)
+{
+    return s_max_pinned_num;
+}
+
+void lndpi_frame_block_reset_max_pinned_num(void)
+{
+    s_max_pinned_num = s_pinned_num;
+}
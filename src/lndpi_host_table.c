@@ -0,0 +1,187 @@
+#include "lndpi_host_table.h"
+#include "lndpi_packet_flow.h"
+#include "lndpi_memory_pool.h"
+
+#include <string.h>
+
+enum lndpi_error lndpi_host_table_init(
+    struct lndpi_host_table* table,
+    uint32_t max_entries,
+    uint64_t ttl_ms
+) {
+    uint32_t buckets_number = 1;
+
+    while (buckets_number < max_entries && buckets_number < (1u << 30))
+        buckets_number <<= 1;
+
+    size_t buckets_size = (size_t)buckets_number * sizeof(struct lndpi_host_entry*);
+
+    memset(table, 0, sizeof(struct lndpi_host_table));
+
+    if ((table->buckets = (struct lndpi_host_entry**)ndpi_malloc(buckets_size)) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+    memset(table->buckets, 0, buckets_size);
+
+    table->buckets_mask = buckets_number - 1;
+    table->max_entries = max_entries;
+    table->ttl_ms = ttl_ms;
+
+    return LNDPI_OK;
+}
+
+void lndpi_host_table_exit(struct lndpi_host_table* table)
+{
+    uint32_t i;
+
+    if (table->buckets == NULL)
+        return;
+
+    for (i = 0; i <= table->buckets_mask; ++i)
+    {
+        struct lndpi_host_entry* entry = table->buckets[i], * next;
+
+        for (; entry != NULL; entry = next)
+        {
+            next = entry->hash_next;
+
+            ndpi_free(entry);
+        }
+    }
+
+    ndpi_free(table->buckets);
+
+    table->buckets = NULL;
+    table->entries_num = 0;
+    table->overflows = 0;
+    table->idle_head = table->idle_tail = NULL;
+}
+
+static struct lndpi_host_entry** lndpi_host_table_bucket(struct lndpi_host_table* table, struct in_addr addr)
+{
+    return &table->buckets[lndpi_packet_flow_hash(addr, addr, 0, 0) & table->buckets_mask];
+}
+
+static void lndpi_host_table_idle_unlink(struct lndpi_host_table* table, struct lndpi_host_entry* entry)
+{
+    if (entry->idle_prev != NULL)
+        entry->idle_prev->idle_next = entry->idle_next;
+    else
+        table->idle_head = entry->idle_next;
+
+    if (entry->idle_next != NULL)
+        entry->idle_next->idle_prev = entry->idle_prev;
+    else
+        table->idle_tail = entry->idle_prev;
+
+    entry->idle_prev = entry->idle_next = NULL;
+}
+
+static void lndpi_host_table_remove(struct lndpi_host_table* table, struct lndpi_host_entry* entry)
+{
+    struct lndpi_host_entry** link = lndpi_host_table_bucket(table, entry->addr);
+
+    while (*link != entry)
+        link = &(*link)->hash_next;
+
+    *link = entry->hash_next;
+
+    lndpi_host_table_idle_unlink(table, entry);
+
+    --table->entries_num;
+}
+
+static struct ndpi_id_struct* lndpi_host_entry_id_struct(struct lndpi_host_entry* entry)
+{
+    return (struct ndpi_id_struct*)(entry + 1);
+}
+
+struct ndpi_id_struct* lndpi_host_table_acquire(struct lndpi_host_table* table, struct in_addr addr)
+{
+    struct lndpi_host_entry** bucket = lndpi_host_table_bucket(table, addr);
+    struct lndpi_host_entry* entry;
+
+    for (entry = *bucket; entry != NULL; entry = entry->hash_next)
+        if (entry->addr.s_addr == addr.s_addr)
+        {
+            if (entry->refs++ == 0)
+                lndpi_host_table_idle_unlink(table, entry);
+
+            return lndpi_host_entry_id_struct(entry);
+        }
+
+    /* Reuse the least recently released host if the table is full */
+    if (table->entries_num >= table->max_entries)
+    {
+        if ((entry = table->idle_head) == NULL)
+        {
+            ++table->overflows;
+
+            return NULL;
+        }
+
+        lndpi_host_table_remove(table, entry);
+    } else if ((entry = (struct lndpi_host_entry*)lndpi_memory_pool_alloc(
+        LNDPI_MEMORY_POOL_ID_STRUCTS,
+        LNDPI_HOST_ENTRY_SIZE)) == NULL)
+        return NULL;
+
+    memset(entry, 0, LNDPI_HOST_ENTRY_SIZE);
+
+    entry->addr = addr;
+    entry->refs = 1;
+    entry->hash_next = *bucket;
+    *bucket = entry;
+
+    ++table->entries_num;
+
+    return lndpi_host_entry_id_struct(entry);
+}
+
+void lndpi_host_table_release(
+    struct lndpi_host_table* table,
+    struct ndpi_id_struct* id_struct,
+    uint64_t time_ms
+) {
+    if (id_struct == NULL)
+        return;
+
+    struct lndpi_host_entry* entry = (struct lndpi_host_entry*)id_struct - 1;
+
+    if (--entry->refs > 0)
+        return;
+
+    entry->released_ms = time_ms;
+
+    /* Keep idle list ordered by release time as flows are not released in packet order */
+    struct lndpi_host_entry* prev = table->idle_tail;
+
+    while (prev != NULL && prev->released_ms > time_ms)
+        prev = prev->idle_prev;
+
+    entry->idle_prev = prev;
+    entry->idle_next = prev != NULL ? prev->idle_next : table->idle_head;
+
+    if (entry->idle_next != NULL)
+        entry->idle_next->idle_prev = entry;
+    else
+        table->idle_tail = entry;
+
+    if (prev != NULL)
+        prev->idle_next = entry;
+    else
+        table->idle_head = entry;
+}
+
+void lndpi_host_table_expire(struct lndpi_host_table* table, uint64_t now_ms)
+{
+    struct lndpi_host_entry* entry;
+
+    while ((entry = table->idle_head) != NULL
+        && now_ms > entry->released_ms
+        && now_ms - entry->released_ms > table->ttl_ms)
+    {
+        lndpi_host_table_remove(table, entry);
+
+        ndpi_free(entry);
+    }
+}
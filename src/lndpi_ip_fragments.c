@@ -0,0 +1,235 @@
+#include "lndpi_ip_fragments.h"
+
+#include <string.h>
+
+#define LNDPI_IP_MORE_FRAGMENTS 0x2000
+#define LNDPI_IP_DONT_FRAGMENT 0x4000
+#define LNDPI_IP_OFFSET_MASK 0x1fff
+
+enum lndpi_ip_fragment_type lndpi_ip_fragment_type(const struct ndpi_iphdr* iph)
+{
+    uint16_t frag_off = ntohs(iph->frag_off);
+
+    if (frag_off & LNDPI_IP_OFFSET_MASK)
+        return LNDPI_IP_NEXT_FRAGMENT;
+
+    return frag_off & LNDPI_IP_MORE_FRAGMENTS ? LNDPI_IP_FIRST_FRAGMENT : LNDPI_IP_NOT_FRAGMENT;
+}
+
+enum lndpi_error lndpi_ip_fragments_init(
+    struct lndpi_ip_fragments* table,
+    uint32_t size,
+    uint64_t ttl_ms,
+    uint32_t max_datagram_size
+) {
+    uint32_t sets_number = 1;
+
+    while (sets_number * LNDPI_IP_FRAGMENT_WAYS < size && sets_number < (1u << 24))
+        sets_number <<= 1;
+
+    size_t entries_size = (size_t)sets_number * LNDPI_IP_FRAGMENT_WAYS * sizeof(struct lndpi_ip_fragment_entry);
+
+    if ((table->entries = (struct lndpi_ip_fragment_entry*)ndpi_malloc(entries_size)) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+    memset(table->entries, 0, entries_size);
+
+    /* Payload is kept in 8 byte blocks and must fit into IP total length */
+    if (max_datagram_size > 65535 - LNDPI_IP_MAX_HEADER_SIZE)
+        max_datagram_size = 65535 - LNDPI_IP_MAX_HEADER_SIZE;
+
+    table->sets_mask = sets_number - 1;
+    table->ttl_ms = ttl_ms;
+    table->max_datagram_size = max_datagram_size & ~7u;
+
+    return LNDPI_OK;
+}
+
+void lndpi_ip_fragments_exit(struct lndpi_ip_fragments* table)
+{
+    if (table->entries == NULL)
+        return;
+
+    uint32_t entries_number = (table->sets_mask + 1) * LNDPI_IP_FRAGMENT_WAYS;
+
+    for (uint32_t i = 0; i < entries_number; ++i)
+        ndpi_free(table->entries[i].datagram);
+
+    ndpi_free(table->entries);
+
+    table->entries = NULL;
+}
+
+static uint8_t lndpi_ip_fragment_entry_matches(
+    const struct lndpi_ip_fragment_entry* entry,
+    const struct ndpi_iphdr* iph
+) {
+    return entry->valid
+        && entry->ip_id == iph->id
+        && entry->ip_protocol == iph->protocol
+        && entry->src_addr.s_addr == iph->saddr
+        && entry->dst_addr.s_addr == iph->daddr;
+}
+
+/**
+ *  Find an entry of a datagram
+ *  If there is no entry and create is set, a free, expired or the least recently updated
+ *  entry of the set is taken
+ */
+static struct lndpi_ip_fragment_entry* lndpi_ip_fragments_entry(
+    struct lndpi_ip_fragments* table,
+    const struct ndpi_iphdr* iph,
+    uint64_t now_ms,
+    uint8_t create
+) {
+    struct in_addr src_addr = { iph->saddr }, dst_addr = { iph->daddr };
+
+    uint32_t hash = lndpi_packet_flow_hash(src_addr, dst_addr, iph->id, iph->protocol);
+
+    struct lndpi_ip_fragment_entry* set = &table->entries[(hash & table->sets_mask) * LNDPI_IP_FRAGMENT_WAYS];
+    struct lndpi_ip_fragment_entry* victim = &set[0];
+    uint8_t victim_expired = 0;
+
+    for (int i = 0; i < LNDPI_IP_FRAGMENT_WAYS; ++i)
+    {
+        uint8_t expired = !set[i].valid || now_ms - set[i].updated_ms > table->ttl_ms;
+
+        if (!expired && lndpi_ip_fragment_entry_matches(&set[i], iph))
+        {
+            set[i].updated_ms = now_ms;
+
+            return &set[i];
+        }
+
+        if (expired)
+        {
+            victim = &set[i];
+            victim_expired = 1;
+        } else if (!victim_expired && set[i].updated_ms < victim->updated_ms)
+            victim = &set[i];
+    }
+
+    if (!create)
+        return NULL;
+
+    /* Keep the reassembly buffer for the next datagram */
+    uint8_t* datagram = victim->datagram;
+
+    memset(victim, 0, sizeof(*victim));
+
+    if (datagram != NULL)
+    {
+        memset(datagram + LNDPI_IP_MAX_HEADER_SIZE + table->max_datagram_size, 0, table->max_datagram_size / 64 + 1);
+        victim->datagram = datagram;
+    }
+
+    victim->valid = 1;
+    victim->updated_ms = now_ms;
+    victim->src_addr = src_addr;
+    victim->dst_addr = dst_addr;
+    victim->ip_id = iph->id;
+    victim->ip_protocol = iph->protocol;
+
+    return victim;
+}
+
+void lndpi_ip_fragments_put_ports(
+    struct lndpi_ip_fragments* table,
+    const struct ndpi_iphdr* iph,
+    uint16_t src_port,
+    uint16_t dst_port,
+    uint64_t now_ms
+) {
+    struct lndpi_ip_fragment_entry* entry = lndpi_ip_fragments_entry(table, iph, now_ms, 1);
+
+    entry->src_port = src_port;
+    entry->dst_port = dst_port;
+    entry->ports_known = 1;
+}
+
+uint8_t lndpi_ip_fragments_find_ports(
+    struct lndpi_ip_fragments* table,
+    const struct ndpi_iphdr* iph,
+    uint64_t now_ms,
+    uint16_t* src_port,
+    uint16_t* dst_port
+) {
+    struct lndpi_ip_fragment_entry* entry = lndpi_ip_fragments_entry(table, iph, now_ms, 0);
+
+    if (entry == NULL || !entry->ports_known)
+        return 0;
+
+    *src_port = entry->src_port;
+    *dst_port = entry->dst_port;
+
+    return 1;
+}
+
+uint8_t lndpi_ip_fragments_reassemble(
+    struct lndpi_ip_fragments* table,
+    const struct ndpi_iphdr* iph,
+    uint16_t length,
+    uint64_t now_ms,
+    const uint8_t** datagram,
+    uint16_t* datagram_length
+) {
+    uint32_t header_length = iph->ihl * 4;
+    uint32_t frag_off = ntohs(iph->frag_off);
+    uint32_t offset = (frag_off & LNDPI_IP_OFFSET_MASK) * 8;
+
+    if (length <= header_length)
+        return 0;
+
+    uint32_t payload_length = length - header_length;
+
+    if (offset + payload_length > table->max_datagram_size)
+        return 0;
+
+    struct lndpi_ip_fragment_entry* entry = lndpi_ip_fragments_entry(table, iph, now_ms, 1);
+
+    if (entry->reassembled)
+        return 0;
+
+    if (entry->datagram == NULL
+        && (entry->datagram = (uint8_t*)ndpi_calloc(
+            1,
+            LNDPI_IP_MAX_HEADER_SIZE + table->max_datagram_size + table->max_datagram_size / 64 + 1)
+        ) == NULL)
+        return 0;
+
+    uint8_t* payload = entry->datagram + LNDPI_IP_MAX_HEADER_SIZE;
+    uint8_t* blocks = payload + table->max_datagram_size;
+
+    memcpy(payload + offset, (const uint8_t*)iph + header_length, payload_length);
+
+    for (uint32_t block = offset / 8; block < (offset + payload_length + 7) / 8; ++block)
+        blocks[block / 8] |= 1 << (block % 8);
+
+    if (offset == 0)
+    {
+        memcpy(entry->datagram + LNDPI_IP_MAX_HEADER_SIZE - header_length, iph, header_length);
+        entry->header_length = header_length;
+    }
+
+    if (!(frag_off & LNDPI_IP_MORE_FRAGMENTS))
+        entry->payload_length = offset + payload_length;
+
+    if (entry->header_length == 0 || entry->payload_length == 0)
+        return 0;
+
+    for (uint32_t block = 0; block < (entry->payload_length + 7) / 8; ++block)
+        if (!(blocks[block / 8] & (1 << (block % 8))))
+            return 0;
+
+    /* Make the header describe an unfragmented datagram */
+    struct ndpi_iphdr* header = (struct ndpi_iphdr*)(payload - entry->header_length);
+
+    header->tot_len = htons(entry->header_length + entry->payload_length);
+    header->frag_off &= htons(LNDPI_IP_DONT_FRAGMENT);
+
+    entry->reassembled = 1;
+
+    *datagram = (const uint8_t*)header;
+    *datagram_length = entry->header_length + entry->payload_length;
+
+    return 1;
+}
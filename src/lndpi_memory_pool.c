@@ -0,0 +1,256 @@
+#include "lndpi_memory_pool.h"
+#include "lndpi_numa.h"
+
+#include "ndpi_api.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define LNDPI_MEMORY_POOL_ALIGN 64
+
+#define LNDPI_HUGE_PAGE_2M (2ul << 20)
+#define LNDPI_HUGE_PAGE_1G (1ul << 30)
+
+/* Max part of a 1G page mapping which may be left unused by rounding up, as a divisor */
+#define LNDPI_HUGE_PAGE_1G_MAX_WASTE 4
+
+/**
+ *  Pool of fixed size objects in one mapping
+ *  Objects are taken from the free list first and then from the never used tail
+ */
+struct lndpi_memory_pool
+{
+    uint8_t* memory;                        /* Mapped memory; NULL if pool is not active */
+    size_t memory_size;                     /* Size of the mapping */
+    size_t object_size;                     /* Size of one object */
+    uint8_t* unused;                        /* First never used object */
+    uint8_t* end;                           /* End of the last object */
+    void* free_list;                        /* Freed objects linked through their first bytes */
+    enum lndpi_memory_backing backing;      /* Backing of the mapping */
+};
+
+static struct lndpi_memory_pool s_pools[LNDPI_MEMORY_POOLS_NUMBER];
+static uint8_t s_free_hook_set = 0;
+static uint64_t s_fallback_num = 0;
+
+static size_t lndpi_round_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+/**
+ *  Map memory with the preferred backing or the first weaker one which works
+ *  Pools which would leave much of their last 1G page unused take 2M pages instead
+ */
+static void* lndpi_memory_map(size_t* size, enum lndpi_memory_backing* backing)
+{
+    void* memory;
+    size_t map_size;
+
+    switch (*backing) {
+        case LNDPI_MEMORY_BACKING_HUGETLB_1G:
+            map_size = lndpi_round_up(*size, LNDPI_HUGE_PAGE_1G);
+            if (map_size - *size <= map_size / LNDPI_HUGE_PAGE_1G_MAX_WASTE)
+            {
+                memory = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+                if (memory != MAP_FAILED)
+                    break;
+            }
+            *backing = LNDPI_MEMORY_BACKING_HUGETLB_2M;
+            /* fall through */
+        case LNDPI_MEMORY_BACKING_HUGETLB_2M:
+            map_size = lndpi_round_up(*size, LNDPI_HUGE_PAGE_2M);
+            memory = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+            if (memory != MAP_FAILED)
+                break;
+            *backing = LNDPI_MEMORY_BACKING_THP;
+            /* fall through */
+        case LNDPI_MEMORY_BACKING_THP:
+            map_size = lndpi_round_up(*size, LNDPI_HUGE_PAGE_2M);
+            memory = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+                return NULL;
+            if (madvise(memory, map_size, MADV_HUGEPAGE) != 0)
+                *backing = LNDPI_MEMORY_BACKING_MMAP;
+            break;
+        case LNDPI_MEMORY_BACKING_MMAP:
+            map_size = *size;
+            memory = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+                return NULL;
+            break;
+        default:
+            return NULL;
+    }
+
+    *size = map_size;
+
+    return memory;
+}
+
+/**
+ *  Find a pool which owns an object
+ */
+static struct lndpi_memory_pool* lndpi_memory_pool_owner(void* ptr)
+{
+    uint8_t* object = (uint8_t*)ptr;
+
+    for (int i = 0; i < LNDPI_MEMORY_POOLS_NUMBER; ++i)
+        if (object >= s_pools[i].memory && object < s_pools[i].end)
+            return &s_pools[i];
+
+    return NULL;
+}
+
+/**
+ *  nDPI free function
+ *  Objects of pools are put in free lists and the rest is passed to free()
+ */
+static void lndpi_memory_pool_free(void* ptr)
+{
+    struct lndpi_memory_pool* pool;
+
+    if (ptr == NULL)
+        return;
+
+    if ((pool = lndpi_memory_pool_owner(ptr)) == NULL)
+    {
+        free(ptr);
+        return;
+    }
+
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+}
+
+enum lndpi_error lndpi_memory_pool_init(
+    enum lndpi_memory_pool_id pool_id,
+    size_t object_size,
+    uint32_t objects_number,
+    enum lndpi_memory_backing backing
+) {
+    struct lndpi_memory_pool* pool = &s_pools[pool_id];
+
+    if (backing == LNDPI_MEMORY_BACKING_MALLOC || objects_number == 0)
+        return LNDPI_OK;
+
+    object_size = lndpi_round_up(object_size < sizeof(void*) ? sizeof(void*) : object_size, LNDPI_MEMORY_POOL_ALIGN);
+
+    size_t size = object_size * objects_number;
+
+    if ((pool->memory = (uint8_t*)lndpi_memory_map(&size, &backing)) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+
+    pool->memory_size = size;
+    pool->object_size = object_size;
+    pool->unused = pool->memory;
+    pool->end = pool->memory + object_size * objects_number;
+    pool->free_list = NULL;
+    pool->backing = backing;
+
+    if (!s_free_hook_set)
+    {
+        set_ndpi_free(lndpi_memory_pool_free);
+        s_free_hook_set = 1;
+    }
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_memory_pool_bind(int32_t node)
+{
+    enum lndpi_error error;
+
+    for (int i = 0; i < LNDPI_MEMORY_POOLS_NUMBER; ++i)
+        if (s_pools[i].memory != NULL
+            && (error = lndpi_numa_bind_memory(s_pools[i].memory, s_pools[i].memory_size, node)) != LNDPI_OK)
+            return error;
+
+    return LNDPI_OK;
+}
+
+void lndpi_memory_pool_exit(void)
+{
+    for (int i = 0; i < LNDPI_MEMORY_POOLS_NUMBER; ++i)
+    {
+        if (s_pools[i].memory != NULL)
+            munmap(s_pools[i].memory, s_pools[i].memory_size);
+
+        s_pools[i].memory = NULL;
+        s_pools[i].end = NULL;
+    }
+
+    if (s_free_hook_set)
+    {
+        set_ndpi_free(NULL);
+        s_free_hook_set = 0;
+    }
+
+    s_fallback_num = 0;
+}
+
+void* lndpi_memory_pool_alloc(enum lndpi_memory_pool_id pool_id, size_t size)
+{
+    struct lndpi_memory_pool* pool = &s_pools[pool_id];
+    void* object;
+
+    if (pool->memory == NULL || size > pool->object_size)
+        return ndpi_malloc(size);
+
+    if ((object = pool->free_list) != NULL)
+    {
+        pool->free_list = *(void**)object;
+        return object;
+    }
+
+    if (pool->unused < pool->end)
+    {
+        object = pool->unused;
+        pool->unused += pool->object_size;
+        return object;
+    }
+
+    ++s_fallback_num;
+
+    return ndpi_malloc(size);
+}
+
+enum lndpi_memory_backing lndpi_memory_pool_backing(void)
+{
+    enum lndpi_memory_backing backing = LNDPI_MEMORY_BACKING_MALLOC;
+    uint8_t active = 0;
+
+    for (int i = 0; i < LNDPI_MEMORY_POOLS_NUMBER; ++i)
+    {
+        if (s_pools[i].memory == NULL)
+            continue;
+
+        if (!active || s_pools[i].backing < backing)
+            backing = s_pools[i].backing;
+
+        active = 1;
+    }
+
+    return backing;
+}
+
+uint64_t lndpi_memory_pool_fallback_num(void)
+{
+    return s_fallback_num;
+}
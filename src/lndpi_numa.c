@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+
+#include "lndpi_numa.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Memory policy mode from linux/mempolicy.h */
+#define LNDPI_MPOL_PREFERRED 1
+
+#define LNDPI_NODEMASK_WORDS (LNDPI_NUMA_MAX_NODES / (8 * sizeof(unsigned long)))
+
+/**
+ *  Read the first line of a sysfs file
+ */
+static uint8_t lndpi_read_sysfs_line(const char* path, char* buffer, size_t size)
+{
+    FILE* file;
+    uint8_t res;
+
+    if ((file = fopen(path, "r")) == NULL)
+        return 0;
+
+    res = fgets(buffer, size, file) != NULL;
+
+    fclose(file);
+
+    return res;
+}
+
+/**
+ *  Make a node mask with a single node
+ */
+static uint8_t lndpi_numa_nodemask(int32_t node, unsigned long* nodemask)
+{
+    if (node < 0 || node >= LNDPI_NUMA_MAX_NODES)
+        return 0;
+
+    memset(nodemask, 0, LNDPI_NODEMASK_WORDS * sizeof(unsigned long));
+    nodemask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+
+    return 1;
+}
+
+int32_t lndpi_numa_interface_node(const char* interface_name)
+{
+    char path[256], line[32];
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", interface_name);
+
+    if (!lndpi_read_sysfs_line(path, line, sizeof(line)))
+        return -1;
+
+    return (int32_t)strtol(line, NULL, 10);
+}
+
+enum lndpi_error lndpi_numa_bind_thread(int32_t node, uint32_t* cpus_number)
+{
+    char path[128], cpulist[4096];
+    unsigned long nodemask[LNDPI_NODEMASK_WORDS];
+    cpu_set_t cpus;
+
+    if (!lndpi_numa_nodemask(node, nodemask))
+        return LNDPI_CANT_BIND_NUMA_NODE;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+    if (!lndpi_read_sysfs_line(path, cpulist, sizeof(cpulist)))
+        return LNDPI_CANT_BIND_NUMA_NODE;
+
+    /* Parse a list like "0-7,16-23" */
+    CPU_ZERO(&cpus);
+
+    char* iter = cpulist;
+
+    while (*iter >= '0' && *iter <= '9')
+    {
+        long first = strtol(iter, &iter, 10), last = first;
+
+        if (*iter == '-')
+            last = strtol(iter + 1, &iter, 10);
+
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &cpus);
+
+        if (*iter == ',')
+            ++iter;
+    }
+
+    if ((*cpus_number = CPU_COUNT(&cpus)) == 0
+        || sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+        return LNDPI_CANT_BIND_NUMA_NODE;
+
+    if (syscall(SYS_set_mempolicy, LNDPI_MPOL_PREFERRED, nodemask, LNDPI_NUMA_MAX_NODES + 1) != 0)
+        return LNDPI_CANT_BIND_NUMA_NODE;
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_numa_bind_memory(void* addr, size_t size, int32_t node)
+{
+    unsigned long nodemask[LNDPI_NODEMASK_WORDS];
+
+    if (!lndpi_numa_nodemask(node, nodemask))
+        return LNDPI_CANT_BIND_NUMA_NODE;
+
+    if (syscall(SYS_mbind, addr, size, LNDPI_MPOL_PREFERRED, nodemask, LNDPI_NUMA_MAX_NODES + 1, 0) != 0)
+        return LNDPI_CANT_BIND_NUMA_NODE;
+
+    return LNDPI_OK;
+}
@@ -1,6 +1,67 @@
 #include "lndpi_packet.h"
 #include "lndpi_packet_buffers.h"
 #include "lndpi_packet_logger.h"
+#include "lndpi_flow_snapshot.h"
+#include "lndpi_endpoint_cache.h"
+#include "lndpi_frame_block.h"
+#include "lndpi_memory_pool.h"
+#include "lndpi_numa.h"
+#include "lndpi_ip_fragments.h"
+#include "lndpi_host_table.h"
+
+#include <string.h>
+#include <time.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+
+/* Number of oldest buffered packets whose flows are given up on each housekeeping under high memory pressure */
+#define LNDPI_MEMORY_PRESSURE_GIVEUP_SCAN 64
+
+/* Size of an 802.1Q tag left in a frame */
+#define LNDPI_VLAN_HEADER_SIZE 4
+
+/* Offset of the flags byte in TCP header */
+#define LNDPI_TCP_FLAGS_OFFSET 13
+
+/* Packet callback called by the pipeline; a direct call if it is bound at compile time */
+#ifdef LNDPI_STATIC_PACKET_CALLBACK
+enum lndpi_error LNDPI_STATIC_PACKET_CALLBACK(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet_struct,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+);
+#define LNDPI_PACKET_CALLBACK LNDPI_STATIC_PACKET_CALLBACK
+#else
+#define LNDPI_PACKET_CALLBACK s_packet_callback
+#endif
+
+/* Buffers callback called by housekeeping; the default one is called directly if it is bound at compile time */
+#ifdef LNDPI_STATIC_BUFFERS_CALLBACK
+#define LNDPI_BUFFERS_CALLBACK lndpi_process_buffers
+#else
+#define LNDPI_BUFFERS_CALLBACK s_buffers_callback
+#endif
+
+/* Ethertypes of VLAN tags */
+#define LNDPI_VLAN_ETHERTYPE(ethertype) \
+    ((ethertype) == ETH_P_8021Q || (ethertype) == ETH_P_8021AD || (ethertype) == ETH_P_QINQ1)
+
+/* Ethertypes accepted by the parser */
+#ifdef LNDPI_NO_IPV6
+#define LNDPI_IP_ETHERTYPE(ethertype) ((ethertype) == ETH_P_IP)
+#else
+#define LNDPI_IP_ETHERTYPE(ethertype) ((ethertype) == ETH_P_IP || (ethertype) == ETH_P_IPV6)
+#endif
+
+/* Per-packet statistics counters */
+#ifdef LNDPI_NO_STATS
+#define LNDPI_STATS_ADD(field, value) ((void)0)
+#else
+#define LNDPI_STATS_ADD(field, value) (s_stats.field += (value))
+#endif
+#define LNDPI_STATS_INC(field) LNDPI_STATS_ADD(field, 1)
 
 /* Global variables for all necessary resources */
 static struct ndpi_detection_module_struct* s_ndpi_struct;
@@ -10,27 +71,106 @@ static uint32_t s_max_flow_number;
 static uint32_t s_max_packets_to_process;
 static uint32_t s_packet_buffer_size;
 static uint64_t s_flow_timeout_ms;
+static uint32_t s_prefetch_depth = LNDPI_DEFAULT_PREFETCH_DEPTH;
+static enum lndpi_packet_buffer_policy s_packet_buffer_policy = LNDPI_PACKET_BUFFER_POLICY_ERROR;
+static enum lndpi_flow_buffer_policy s_flow_buffer_policy = LNDPI_FLOW_BUFFER_POLICY_ERROR;
+static const char* s_flow_snapshot_file_path;
+static uint8_t s_zero_copy = 0;
+static uint64_t s_max_packet_hold_ms = 0;
+static uint64_t s_memory_budget = 0;
+static uint32_t s_effective_max_packets_to_process;
+static uint64_t s_effective_max_packet_hold_ms;
+static enum lndpi_memory_backing s_memory_backing = LNDPI_MEMORY_BACKING_MALLOC;
+static int32_t s_numa_node = -1;
+static const char* s_numa_interface_name;
+static uint32_t s_housekeeping_packets = 1;
+static uint64_t s_housekeeping_interval_ms = 0;
+static uint32_t s_packets_since_housekeeping;
+static uint64_t s_last_housekeeping_ms;
+static uint8_t s_flow_hibernation = 1;
+static uint32_t s_hot_flow_cache_size = 256;
+static struct lndpi_flow_query_table s_flow_query;
+static uint8_t s_flow_query_enabled = 0;
+
+static ndpi_init_prefs s_detection_prefs = ndpi_no_prefs;
+static NDPI_PROTOCOL_BITMASK s_detection_bitmask;
+static uint8_t s_detection_bitmask_set = 0;
+static const char* s_protocols_file_path;
+static const char* s_categories_file_path;
+static uint8_t s_protocol_guessing = 1;
+
+static uint64_t s_subscribed_protocols[65536 / 64];
+static uint8_t s_subscribed_categories[NDPI_PROTOCOL_NUM_CATEGORIES];
+static uint8_t s_subscriptions_set = 0;
+
+static struct lndpi_endpoint_cache s_endpoint_cache;
+static uint32_t s_endpoint_cache_size = 0;
+static uint64_t s_endpoint_cache_ttl_ms;
+
+static struct lndpi_ip_fragments s_ip_fragments;
+static uint32_t s_ip_fragments_size = 1024;
+static uint64_t s_ip_fragments_ttl_ms = 30000;
+static uint32_t s_ip_max_datagram_size = 0;
+
+static struct lndpi_host_table s_host_table;
+static uint32_t s_host_table_size = 65536;
+static uint64_t s_host_table_ttl_ms = 300000;
+
+static struct lndpi_packet_lib_stats s_stats;
 
 static lndpi_packet_callback_t s_packet_callback;
 static void* s_packet_callback_parameter;
 
+static lndpi_packet_batch_callback_t s_packet_batch_callback;
+static void* s_packet_batch_callback_parameter;
+
 static lndpi_buffers_callback_t s_buffers_callback;
 static void* s_buffers_callback_parameter;
 
 static lndpi_finalize_callback_t s_finalize_callback;
 static void* s_finalize_callback_parameter;
 
+static lndpi_flow_callback_t s_flow_eviction_callback;
+static void* s_flow_eviction_callback_parameter;
+
+static lndpi_flow_callback_t s_flow_verdict_callback;
+static void* s_flow_verdict_callback_parameter;
+
 /**
  *  Initialization of an nDPI detection module
  */
 static enum lndpi_error lndpi_detection_module_init(void)
 {
-    if ((s_ndpi_struct = ndpi_init_detection_module(ndpi_no_prefs)) == NULL)
+    if ((s_ndpi_struct = ndpi_init_detection_module(s_detection_prefs)) == NULL)
         return LNDPI_NDPI_MODULE_INIT_ERROR;
 
     NDPI_PROTOCOL_BITMASK all;
-    NDPI_BITMASK_SET_ALL(all);
+
+    if (s_detection_bitmask_set)
+        all = s_detection_bitmask;
+    else
+        NDPI_BITMASK_SET_ALL(all);
+
     ndpi_set_protocol_detection_bitmask2(s_ndpi_struct, &all);
+
+    if (s_protocols_file_path != NULL
+        && ndpi_load_protocols_file(s_ndpi_struct, s_protocols_file_path) != 0)
+    {
+        ndpi_exit_detection_module(s_ndpi_struct);
+        s_ndpi_struct = NULL;
+
+        return LNDPI_CANT_LOAD_PROTOCOLS_FILE;
+    }
+
+    if (s_categories_file_path != NULL
+        && ndpi_load_categories_file(s_ndpi_struct, s_categories_file_path) < 0)
+    {
+        ndpi_exit_detection_module(s_ndpi_struct);
+        s_ndpi_struct = NULL;
+
+        return LNDPI_CANT_LOAD_CATEGORIES_FILE;
+    }
+
     ndpi_finalize_initialization(s_ndpi_struct);
 
     return LNDPI_OK;
@@ -39,12 +179,20 @@ static enum lndpi_error lndpi_detection_module_init(void)
 /**
  *  Helper function for initializing flow buffer
  */
-static void lndpi_flow_buffer_init(uint32_t max_flow_number)
+static enum lndpi_error lndpi_flow_buffer_init(uint32_t max_flow_number)
 {
     s_flow_buffer.head = NULL;
     s_flow_buffer.tail = NULL;
     s_flow_buffer.elements_number = 0;
     s_flow_buffer.max_elements_number = max_flow_number;
+    s_flow_buffer.clock_hand = NULL;
+
+    enum lndpi_error error;
+
+    if ((error = lndpi_flow_buffer_index_init(&s_flow_buffer, max_flow_number)) != LNDPI_OK)
+        return error;
+
+    return lndpi_flow_buffer_hot_cache_init(&s_flow_buffer, s_hot_flow_cache_size);
 }
 
 /**
@@ -56,6 +204,11 @@ static void lndpi_packet_buffer_init(uint32_t packet_buffer_size)
     s_packet_buffer.tail = NULL;
     s_packet_buffer.elements_number = 0;
     s_packet_buffer.max_elements_number = packet_buffer_size;
+    s_packet_buffer.buckets = NULL;
+    s_packet_buffer.buckets_mask = 0;
+    s_packet_buffer.clock_hand = NULL;
+    s_packet_buffer.hot_flows = NULL;
+    s_packet_buffer.hot_flows_mask = 0;
 }
 
 /**
@@ -70,6 +223,18 @@ void lndpi_set_packet_callback_function(
     s_packet_callback_parameter = parameter;
 }
 
+/**
+ *  Set packet batch callback function definition
+ */
+void lndpi_set_packet_batch_callback_function(
+    lndpi_packet_batch_callback_t packet_batch_callback,
+    void* parameter
+) {
+    s_packet_batch_callback = packet_batch_callback;
+
+    s_packet_batch_callback_parameter = parameter;
+}
+
 /**
  *  Set buffers callback function definition
  */
@@ -95,284 +260,1625 @@ void lndpi_set_finalize_callback_function(
 }
 
 /**
- *  Default buffers callback function
- *  Send to packet callback function all packets from the begining of the packet buffer which:
- *      - have final protocol decision
- *      - have unknown protocol but:
- *          - have reached maximum number of processed packets
- *          - are in timed out flow
- *  Call flow buffer cleanup funtion
+ *  Set flow eviction callback function definition
  */
-static enum lndpi_error lndpi_process_buffers(
-    struct ndpi_detection_module_struct* ndpi_struct,
-    struct lndpi_linked_list* flow_buffer,
-    struct lndpi_linked_list* packet_buffer,
-    uint64_t timeout_ms,
-    uint32_t max_packets_to_process,
-    uint32_t max_flow_number,
+void lndpi_set_flow_eviction_callback_function(
+    lndpi_flow_callback_t flow_eviction_callback,
     void* parameter
 ) {
-    enum lndpi_error error;
+    s_flow_eviction_callback = flow_eviction_callback;
 
-    struct lndpi_linked_list_element* iter, * iter_next;
-
-    for (iter = packet_buffer->head; iter != NULL; iter = iter_next)
-    {
-        iter_next = iter->next;
+    s_flow_eviction_callback_parameter = parameter;
+}
 
-        if (iter->data.packet->lndpi_flow->protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN)
-        {
-            if (!lndpi_packet_flow_check_timeout(iter->data.packet->lndpi_flow, timeout_ms)
-                && iter->data.packet->lndpi_flow->processed_packets_num <= max_packets_to_process)
-                break;
+/**
+ *  Set flow verdict callback function definition
+ */
+void lndpi_set_flow_verdict_callback_function(
+    lndpi_flow_callback_t flow_verdict_callback,
+    void* parameter
+) {
+    s_flow_verdict_callback = flow_verdict_callback;
 
-            iter->data.packet->lndpi_flow->protocol = ndpi_detection_giveup(
-                ndpi_struct,
-                iter->data.packet->lndpi_flow->ndpi_flow,
-                1,
-                &iter->data.packet->lndpi_flow->protocol_was_guessed
-            );
-        } else
-        {
-            if ((error = s_packet_callback(
-                ndpi_struct,
-                iter->data.packet,
-                timeout_ms,
-                max_packets_to_process,
-                s_packet_callback_parameter)
-            ) != LNDPI_OK)
-                return error;
+    s_flow_verdict_callback_parameter = parameter;
+}
 
-            lndpi_packet_buffer_advance(packet_buffer);
-        }
-    }
+/**
+ *  Set prefetch depth definition
+ */
+void lndpi_set_prefetch_depth(uint32_t depth)
+{
+    if (depth == 0)
+        depth = 1;
+    else if (depth > LNDPI_MAX_PREFETCH_DEPTH)
+        depth = LNDPI_MAX_PREFETCH_DEPTH;
 
-    lndpi_flow_buffer_cleanup(flow_buffer, timeout_ms);
+    s_prefetch_depth = depth;
+}
 
-    return LNDPI_OK;
+/**
+ *  Set packet buffer overload policy definition
+ */
+void lndpi_set_packet_buffer_policy(enum lndpi_packet_buffer_policy policy)
+{
+    s_packet_buffer_policy = policy;
 }
 
 /**
- *  Default finalize callback function
- *  Send all packets from buffer to packet callback function
+ *  Set flow buffer overload policy definition
  */
-static enum lndpi_error lndpi_packet_buffer_log(
-    struct ndpi_detection_module_struct* ndpi_struct,
-    struct lndpi_linked_list* flow_buffer,
-    struct lndpi_linked_list* packet_buffer,
-    uint64_t timeout_ms,
-    uint32_t max_packets_to_process,
-    uint32_t max_flow_number,
-    void* parameter
-)
+void lndpi_set_flow_buffer_policy(enum lndpi_flow_buffer_policy policy)
 {
-    struct lndpi_linked_list_element* iter;
+    s_flow_buffer_policy = policy;
+}
 
-    for (iter = packet_buffer->head; iter != NULL; iter = iter->next)
-    {
-        if (iter->data.packet->lndpi_flow->protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN)
-        {
-            iter->data.packet->lndpi_flow->protocol = ndpi_detection_giveup(
-                ndpi_struct,
-                iter->data.packet->lndpi_flow->ndpi_flow,
-                1,
-                &iter->data.packet->lndpi_flow->protocol_was_guessed
-            );
-        }
+/**
+ *  Set detection preferences definition
+ */
+void lndpi_set_detection_prefs(ndpi_init_prefs prefs)
+{
+    s_detection_prefs = prefs;
+}
 
-        enum lndpi_error error;
-        if ((error = s_packet_callback(
-            ndpi_struct,
-            iter->data.packet,
-            timeout_ms,
-            max_packets_to_process,
-            s_packet_callback_parameter)
-        ) != LNDPI_OK)
-            return error;
-    }
+/**
+ *  Set detection bitmask definition
+ */
+void lndpi_set_detection_bitmask(const NDPI_PROTOCOL_BITMASK* bitmask)
+{
+    if (bitmask != NULL)
+        s_detection_bitmask = *bitmask;
 
-    return LNDPI_OK;
+    s_detection_bitmask_set = bitmask != NULL;
 }
 
 /**
- *  Library initialization function definition
+ *  Set custom protocols file definition
  */
-enum lndpi_error lndpi_packet_lib_init(
-    uint32_t max_flow_number,
-    uint32_t max_packets_to_process,
-    uint32_t packet_buffer_size,
-    uint64_t flow_timeout_ms
-) {
-    s_max_flow_number = max_flow_number;
-    s_max_packets_to_process = max_packets_to_process;
-    s_packet_buffer_size = packet_buffer_size;
-    s_flow_timeout_ms = flow_timeout_ms;
+void lndpi_set_protocols_file_path(const char* protocols_file_path)
+{
+    s_protocols_file_path = protocols_file_path;
+}
 
-    enum lndpi_error error;
+/**
+ *  Set custom categories file definition
+ */
+void lndpi_set_categories_file_path(const char* categories_file_path)
+{
+    s_categories_file_path = categories_file_path;
+}
 
-    if ((error = lndpi_detection_module_init()) != LNDPI_OK)
-        return error;
+/**
+ *  Set protocol guessing definition
+ */
+void lndpi_set_protocol_guessing(uint8_t enable_guess)
+{
+    s_protocol_guessing = enable_guess;
+}
 
-    lndpi_flow_buffer_init(s_max_flow_number);
+/**
+ *  Subscribe protocol definition
+ */
+void lndpi_subscribe_protocol(uint16_t protocol_id)
+{
+    s_subscribed_protocols[protocol_id / 64] |= (uint64_t)1 << (protocol_id % 64);
+    s_subscriptions_set = 1;
+}
 
-    lndpi_packet_buffer_init(s_packet_buffer_size);
+/**
+ *  Subscribe category definition
+ */
+void lndpi_subscribe_category(ndpi_protocol_category_t category)
+{
+    if ((uint32_t)category >= NDPI_PROTOCOL_NUM_CATEGORIES)
+        return;
 
-    s_buffers_callback = lndpi_process_buffers;
-    s_buffers_callback_parameter = NULL;
+    s_subscribed_categories[category] = 1;
+    s_subscriptions_set = 1;
+}
 
-    s_packet_callback = lndpi_log_packet;
-    s_packet_callback_parameter = NULL;
+/**
+ *  Clear subscriptions definition
+ */
+void lndpi_clear_subscriptions(void)
+{
+    memset(s_subscribed_protocols, 0, sizeof(s_subscribed_protocols));
+    memset(s_subscribed_categories, 0, sizeof(s_subscribed_categories));
+    s_subscriptions_set = 0;
+}
 
-    s_finalize_callback = lndpi_packet_buffer_log;
-    s_finalize_callback_parameter = NULL;
+/**
+ *  Set endpoint cache definition
+ */
+void lndpi_set_endpoint_cache(uint32_t size, uint64_t ttl_ms)
+{
+    s_endpoint_cache_size = size;
+    s_endpoint_cache_ttl_ms = ttl_ms;
+}
 
-    return LNDPI_OK;
+/**
+ *  Set hot flow cache size definition
+ */
+void lndpi_set_hot_flow_cache_size(uint32_t size)
+{
+    s_hot_flow_cache_size = size;
 }
 
 /**
- *  Default log file function definition
+ *  Set flow query definition
  */
-enum lndpi_error lndpi_init_log_file(char* log_file_path)
+void lndpi_set_flow_query(uint8_t enabled)
 {
-    enum lndpi_error error;
+    s_flow_query_enabled = enabled;
+}
 
-    if (s_packet_callback == lndpi_log_packet)
-        if ((error = lndpi_logger_init(log_file_path)) != LNDPI_OK)
-            return error;
+/**
+ *  Query flow definition
+ */
+uint8_t lndpi_query_flow(
+    struct in_addr src_addr,
+    struct in_addr dst_addr,
+    uint16_t src_port,
+    uint16_t dst_port,
+    uint8_t ip_protocol,
+    struct lndpi_flow_info* info
+) {
+    if (s_flow_query.buckets == NULL)
+        return 0;
 
-    return LNDPI_OK;
+    return lndpi_flow_query_lookup(
+        &s_flow_query,
+        src_addr,
+        dst_addr,
+        src_port,
+        dst_port,
+        ip_protocol,
+        info
+    );
 }
 
 /**
- *  Finalize function definition
+ *  Query flows definition
  */
-enum lndpi_error lndpi_packet_lib_finalize(void)
+uint32_t lndpi_query_flows(struct lndpi_flow_info* infos, uint32_t max_infos)
 {
-    return s_finalize_callback(
-        s_ndpi_struct,
-        &s_flow_buffer,
-        &s_packet_buffer,
-        s_flow_timeout_ms,
-        s_max_packets_to_process,
-        s_max_flow_number,
-        s_finalize_callback_parameter
-    );
+    if (s_flow_query.buckets == NULL)
+        return 0;
+
+    return lndpi_flow_query_snapshot(&s_flow_query, infos, max_infos);
 }
 
 /**
- *  Library exit funtion definition
+ *  Set host table definition
  */
-void lndpi_packet_lib_exit(void)
+void lndpi_set_host_table(uint32_t max_hosts, uint64_t ttl_ms)
 {
-    lndpi_logger_exit();
+    s_host_table_size = max_hosts;
+    s_host_table_ttl_ms = ttl_ms;
+}
 
-    ndpi_exit_detection_module(s_ndpi_struct);
+/**
+ *  Set zero-copy mode definition
+ */
+void lndpi_set_zero_copy(uint8_t enabled)
+{
+    s_zero_copy = enabled;
+}
 
-    lndpi_flow_buffer_clear(&s_flow_buffer);
+/**
+ *  Set max packet hold time definition
+ */
+void lndpi_set_max_packet_hold_ms(uint64_t max_packet_hold_ms)
+{
+    s_max_packet_hold_ms = max_packet_hold_ms;
+    s_effective_max_packet_hold_ms = max_packet_hold_ms;
+}
 
-    lndpi_packet_buffer_clear(&s_packet_buffer);
+/**
+ *  Set memory budget definition
+ */
+void lndpi_set_memory_budget(uint64_t budget_bytes)
+{
+    s_memory_budget = budget_bytes;
 }
 
 /**
- *  Structure to extract source and destination ports from L4 header
+ *  Set housekeeping interval definition
  */
-struct l4_header_addr
+void lndpi_set_housekeeping_interval(uint32_t packets, uint64_t interval_ms)
 {
-    uint16_t src_port;
-    uint16_t dst_port;
-};
+    s_housekeeping_packets = packets;
+    s_housekeeping_interval_ms = interval_ms;
+}
 
 /**
- *  Check if packet has L4 header
- *  Currently only check if L4 protocol is TCP or UPD
+ *  Set memory backing definition
  */
-static uint8_t lndpi_packet_has_l4header(struct ndpi_iphdr* iph)
+void lndpi_set_memory_backing(enum lndpi_memory_backing backing)
 {
-    return (iph->protocol == IPPROTO_TCP
-        || iph->protocol == IPPROTO_UDP);
+    s_memory_backing = backing;
 }
 
 /**
- *  Main packet processing funtion definition
+ *  Set NUMA node definition
  */
-enum lndpi_error lndpi_process_packet(const struct tpacket3_hdr* pkt)
+void lndpi_set_numa_node(int32_t node)
 {
-    enum lndpi_error error;
+    s_numa_node = node;
+}
 
-    /* Get L3 header from tpacket3_hdr */
-    struct ndpi_iphdr* iph = (struct ndpi_iphdr*)((uint8_t*)pkt + pkt->tp_net);
+/**
+ *  Set NUMA interface definition
+ */
+void lndpi_set_numa_interface(const char* interface_name)
+{
+    s_numa_interface_name = interface_name;
+}
 
-    /* IPv6 is not supported yet */
-    if (iph->version == 6)
-        return LNDPI_IPV6_NOT_SUPPORTED;
+/**
+ *  Set IP fragments handling definition
+ */
+void lndpi_set_ip_fragments(uint32_t table_size, uint64_t ttl_ms, uint32_t max_datagram_size)
+{
+    s_ip_fragments_size = table_size;
+    s_ip_fragments_ttl_ms = ttl_ms;
+    s_ip_max_datagram_size = max_datagram_size;
+}
 
-    /* Get address information from packet */
-    struct in_addr src_addr, dst_addr;
-    uint16_t src_port, dst_port;
+/**
+ *  Set TCP timeouts definition
+ */
+void lndpi_set_tcp_timeouts(uint64_t closed_timeout_ms, uint64_t half_open_timeout_ms)
+{
+    lndpi_packet_flow_set_tcp_timeouts(closed_timeout_ms, half_open_timeout_ms);
+}
 
-    src_addr.s_addr = iph->saddr;
-    dst_addr.s_addr = iph->daddr;
+/**
+ *  Set flow hibernation definition
+ */
+void lndpi_set_flow_hibernation(uint8_t enabled)
+{
+    s_flow_hibernation = enabled;
+}
 
-    if (lndpi_packet_has_l4header(iph))
-    {
-        struct l4_header_addr* l4addr = (struct l4_header_addr*)((uint32_t*)iph + iph->ihl);
+/**
+ *  Set flow snapshot file path definition
+ */
+void lndpi_set_flow_snapshot_file_path(const char* snapshot_file_path)
+{
+    s_flow_snapshot_file_path = snapshot_file_path;
+}
 
-        src_port = ntohs(l4addr->src_port);
-        dst_port = ntohs(l4addr->dst_port);
-    } else
-    {
-        src_port = 0;
-        dst_port = 0;
-    }
+/**
+ *  Save flow snapshot definition
+ */
+enum lndpi_error lndpi_save_flow_snapshot(const char* snapshot_file_path)
+{
+    return lndpi_flow_snapshot_save(&s_flow_buffer, snapshot_file_path);
+}
 
-    /* Check for corresponding flow in the buffer */
-    uint8_t direction;
-    struct lndpi_packet_flow* pkt_flow = lndpi_flow_buffer_find(
-        &s_flow_buffer,
-        src_addr,
-        dst_addr,
-        src_port,
-        dst_port,
+/**
+ *  Estimate memory held by flows, their nDPI state, hosts and buffered packets
+ */
+static uint64_t lndpi_memory_usage(void)
+{
+    return (uint64_t)s_flow_buffer.elements_number
+            * (sizeof(struct lndpi_packet_flow) + sizeof(struct lndpi_linked_list_element))
+        + (uint64_t)s_packet_buffer.elements_number
+            * (sizeof(struct lndpi_packet_struct) + sizeof(struct lndpi_linked_list_element))
+        + (uint64_t)s_host_table.entries_num * LNDPI_HOST_ENTRY_SIZE
+        + lndpi_packet_flow_state_bytes();
+}
+
+/**
+ *  Get statistics definition
+ */
+void lndpi_get_stats(struct lndpi_packet_lib_stats* stats)
+{
+    *stats = s_stats;
+
+    stats->pinned_blocks = lndpi_frame_block_pinned_num();
+    stats->max_pinned_blocks = lndpi_frame_block_max_pinned_num();
+    stats->memory_backing = lndpi_memory_pool_backing();
+    stats->pool_fallback_allocations = lndpi_memory_pool_fallback_num();
+    stats->hosts = s_host_table.entries_num;
+    stats->host_table_overflows = s_host_table.overflows;
+    stats->hot_flow_cache_hits = s_flow_buffer.hot_flow_hits;
+    stats->hot_flow_cache_misses = s_flow_buffer.hot_flow_misses;
+    stats->flow_query_overflows = s_flow_query.overflows;
+    stats->flow_query_read_retries = __atomic_load_n(&s_flow_query.read_retries, __ATOMIC_RELAXED);
+    stats->memory_usage = lndpi_memory_usage();
+    stats->effective_max_packets_to_process = s_effective_max_packets_to_process;
+    stats->effective_max_packet_hold_ms = s_effective_max_packet_hold_ms;
+}
+
+/**
+ *  Check if a protocol ID is subscribed
+ */
+static uint8_t lndpi_protocol_subscribed(uint16_t protocol_id)
+{
+    return (s_subscribed_protocols[protocol_id / 64] >> (protocol_id % 64)) & 1;
+}
+
+/**
+ *  Check if a flow should be passed to callbacks
+ *  Result is cached on the flow once its verdict is final
+ *  Flows without final verdict are always passed
+ */
+static uint8_t lndpi_flow_subscribed(struct lndpi_packet_flow* flow)
+{
+    if (!s_subscriptions_set)
+        return 1;
+
+    if (flow->subscription == LNDPI_SUBSCRIPTION_UNKNOWN)
+    {
+        if (!lndpi_packet_flow_detection_finished(flow))
+            return 1;
+
+        if (lndpi_protocol_subscribed(flow->protocol.master_protocol)
+            || lndpi_protocol_subscribed(flow->protocol.app_protocol)
+            || ((uint32_t)flow->protocol.category < NDPI_PROTOCOL_NUM_CATEGORIES
+                && s_subscribed_categories[flow->protocol.category]))
+            flow->subscription = LNDPI_SUBSCRIPTION_SUBSCRIBED;
+        else
+        {
+            flow->subscription = LNDPI_SUBSCRIPTION_NOT_SUBSCRIBED;
+
+            ++s_stats.unsubscribed_flows;
+        }
+    }
+
+    return flow->subscription == LNDPI_SUBSCRIPTION_SUBSCRIBED;
+}
+
+/**
+ *  Publish flow state for queries from other threads
+ */
+static void lndpi_flow_publish(struct lndpi_packet_flow* flow)
+{
+    if (s_flow_query.buckets != NULL)
+        lndpi_flow_query_publish(&s_flow_query, flow);
+}
+
+/**
+ *  Get the server endpoint of a flow
+ *  The endpoint with the lower port is taken as the server since clients use ephemeral ports,
+ *  so a flow whose first captured packet was a reply is keyed the same way
+ */
+static void lndpi_flow_server_endpoint(struct lndpi_packet_flow* flow, struct in_addr* addr, uint16_t* port)
+{
+    if (flow->dst_port <= flow->src_port)
+    {
+        *addr = flow->dst_addr;
+        *port = flow->dst_port;
+    } else
+    {
+        *addr = flow->src_addr;
+        *port = flow->src_port;
+    }
+}
+
+/**
+ *  Remember the final verdict of a flow for its server endpoint
+ *  Flows which take protocol from the cache skip nDPI, so only verdicts which extra dissection
+ *  can't refine any more are remembered
+ */
+static void lndpi_flow_remember_endpoint(struct lndpi_packet_flow* flow, uint64_t time_ms)
+{
+    struct in_addr addr;
+    uint16_t port;
+
+    if (s_endpoint_cache.entries == NULL || flow->protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN)
+        return;
+
+    lndpi_flow_server_endpoint(flow, &addr, &port);
+
+    lndpi_endpoint_cache_put(
+        &s_endpoint_cache,
+        addr,
+        port,
+        flow->ip_protocol,
+        time_ms,
+        flow->protocol
+    );
+}
+
+/**
+ *  Handle final protocol decision of a flow
+ *  Call flow verdict callback function if some packets of the flow were emitted before it
+ */
+static enum lndpi_error lndpi_flow_verdict_final(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow
+) {
+    flow->subscription = LNDPI_SUBSCRIPTION_UNKNOWN;
+
+    lndpi_flow_publish(flow);
+
+    if (!flow->provisional_packets_emitted || s_flow_verdict_callback == NULL
+        || !lndpi_flow_subscribed(flow))
+        return LNDPI_OK;
+
+    return s_flow_verdict_callback(
+        ndpi_struct,
+        flow,
+        s_flow_verdict_callback_parameter
+    );
+}
+
+/**
+ *  Free nDPI state of a flow and account freed memory
+ */
+static void lndpi_flow_hibernate(struct lndpi_packet_flow* flow)
+{
+    uint32_t freed_bytes;
+
+    if ((freed_bytes = lndpi_packet_flow_hibernate(flow)) == 0)
+        return;
+
+    ++s_stats.hibernated_flows;
+    s_stats.hibernation_freed_bytes += freed_bytes;
+}
+
+/**
+ *  Give up protocol detection of a flow
+ *  Hibernated flows keep their protocol; guessed protocols are remembered for the server endpoint
+ */
+static enum lndpi_error lndpi_flow_giveup(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow
+) {
+    if (!lndpi_packet_flow_hibernated(flow))
+    {
+        flow->protocol = ndpi_detection_giveup(
+            ndpi_struct,
+            flow->ndpi_flow,
+            s_protocol_guessing,
+            &flow->protocol_was_guessed
+        );
+
+        if (flow->protocol_was_guessed)
+            lndpi_flow_remember_endpoint(flow, flow->last_packet_ms);
+
+        if (s_flow_hibernation)
+            lndpi_flow_hibernate(flow);
+    }
+
+    flow->detection_given_up = 1;
+
+    return lndpi_flow_verdict_final(ndpi_struct, flow);
+}
+
+/**
+ *  Mark a packet which is emitted before final protocol decision of its flow
+ */
+static void lndpi_packet_mark_provisional(struct lndpi_packet_struct* packet)
+{
+    if (packet->provisional)
+        return;
+
+    packet->provisional = 1;
+    packet->lndpi_flow->provisional_packets_emitted = 1;
+
+    LNDPI_STATS_INC(provisional_packets);
+}
+
+/**
+ *  Send packets to packet batch callback function if it is set
+ *  Otherwise send them one by one to packet callback function
+ *  Packets of flows which are not subscribed are skipped
+ *  Store number of sent or skipped packets in emitted_num
+ */
+static enum lndpi_error lndpi_emit_packets(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct** packets,
+    uint32_t packets_num,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    uint32_t* emitted_num
+) {
+    enum lndpi_error error;
+
+    *emitted_num = 0;
+
+    if (s_packet_batch_callback != NULL)
+    {
+        struct lndpi_packet_struct* subscribed[LNDPI_PACKET_BATCH_SIZE];
+        uint32_t subscribed_num = 0, i;
+
+        /* Pass the caller's batch as is unless some of its packets are filtered out */
+        for (i = 0; i < packets_num; ++i)
+            if (lndpi_flow_subscribed(packets[i]->lndpi_flow))
+                subscribed[subscribed_num++] = packets[i];
+
+        if (subscribed_num > 0
+            && (error = s_packet_batch_callback(
+                ndpi_struct,
+                subscribed_num == packets_num ? packets : subscribed,
+                subscribed_num,
+                timeout_ms,
+                max_packets_to_process,
+                s_packet_batch_callback_parameter)
+            ) != LNDPI_OK)
+            return error;
+
+        LNDPI_STATS_ADD(unsubscribed_packets, packets_num - subscribed_num);
+
+        *emitted_num = packets_num;
+
+        return LNDPI_OK;
+    }
+
+    for (; *emitted_num < packets_num; ++*emitted_num)
+    {
+        if (!lndpi_flow_subscribed(packets[*emitted_num]->lndpi_flow))
+        {
+            LNDPI_STATS_INC(unsubscribed_packets);
+
+            continue;
+        }
+
+        if ((error = LNDPI_PACKET_CALLBACK(
+            ndpi_struct,
+            packets[*emitted_num],
+            timeout_ms,
+            max_packets_to_process,
+            s_packet_callback_parameter)
+        ) != LNDPI_OK)
+            return error;
+    }
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Send to packet callback function all packets from the begining of the packet buffer which:
+ *      - have final protocol decision
+ *      - have unknown protocol but:
+ *          - have reached maximum number of processed packets
+ *          - are in timed out flow
+ *          - were held longer than the effective max packet hold time
+ *  Packets are collected in batches of up to LNDPI_PACKET_BATCH_SIZE
+ */
+static enum lndpi_error lndpi_packet_buffer_drain(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_linked_list* packet_buffer,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process
+) {
+    enum lndpi_error error;
+
+    struct lndpi_packet_struct* batch[LNDPI_PACKET_BATCH_SIZE];
+    uint32_t batch_size, emitted_num;
+
+    uint64_t now_ms = lndpi_current_time_ms();
+
+    do
+    {
+        struct lndpi_linked_list_element* iter;
+
+        for (iter = packet_buffer->head, batch_size = 0;
+            iter != NULL && batch_size < LNDPI_PACKET_BATCH_SIZE;
+            iter = iter->next)
+        {
+            struct lndpi_packet_flow* flow = iter->data.packet->lndpi_flow;
+
+            if (!lndpi_packet_flow_detection_finished(flow))
+            {
+                if (!lndpi_packet_flow_check_timeout(flow, timeout_ms)
+                    && flow->processed_packets_num <= max_packets_to_process)
+                {
+                    if (s_effective_max_packet_hold_ms == 0
+                        || now_ms - iter->data.packet->time_ms <= s_effective_max_packet_hold_ms)
+                        break;
+
+                    lndpi_packet_mark_provisional(iter->data.packet);
+                } else if ((error = lndpi_flow_giveup(ndpi_struct, flow)) != LNDPI_OK)
+                    return error;
+            }
+
+            batch[batch_size++] = iter->data.packet;
+        }
+
+        if (batch_size == 0)
+            break;
+
+        error = lndpi_emit_packets(
+            ndpi_struct,
+            batch,
+            batch_size,
+            timeout_ms,
+            max_packets_to_process,
+            &emitted_num
+        );
+
+        while (emitted_num-- > 0)
+            lndpi_packet_buffer_advance(packet_buffer);
+
+        if (error != LNDPI_OK)
+            return error;
+    } while (batch_size == LNDPI_PACKET_BATCH_SIZE);
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Give up detection of flows which timed out or reached maximum number of processed packets
+ *  The packet buffer drain gives up only flows with a packet at the head of the buffer;
+ *  flows whose packets were released by the hold time, emitted unclassified or never buffered
+ *  would otherwise stay unknown and never expire
+ */
+static enum lndpi_error lndpi_flow_buffer_giveup_stale(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_linked_list* flow_buffer,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process
+) {
+    enum lndpi_error error;
+
+    struct lndpi_linked_list_element* iter;
+
+    for (iter = flow_buffer->head; iter != NULL; iter = iter->next)
+    {
+        struct lndpi_packet_flow* flow = iter->data.flow;
+
+        if (!lndpi_packet_flow_detection_finished(flow)
+            && (flow->processed_packets_num > max_packets_to_process
+                || lndpi_packet_flow_check_timeout(flow, timeout_ms))
+            && (error = lndpi_flow_giveup(ndpi_struct, flow)) != LNDPI_OK)
+            return error;
+    }
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Default buffers callback function
+ *  Drain the packet buffer
+ *  Give up stale flows and call flow buffer cleanup funtion
+ */
+static enum lndpi_error lndpi_process_buffers(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_linked_list* flow_buffer,
+    struct lndpi_linked_list* packet_buffer,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    uint32_t max_flow_number,
+    void* parameter
+) {
+    enum lndpi_error error;
+
+    if ((error = lndpi_packet_buffer_drain(
+        ndpi_struct,
+        packet_buffer,
+        timeout_ms,
+        max_packets_to_process)
+    ) != LNDPI_OK)
+        return error;
+
+    if ((error = lndpi_flow_buffer_giveup_stale(
+        ndpi_struct,
+        flow_buffer,
+        timeout_ms,
+        max_packets_to_process)
+    ) != LNDPI_OK)
+        return error;
+
+    lndpi_flow_buffer_cleanup(flow_buffer, timeout_ms);
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Give up detection of the oldest buffered packet's flow and drain the packet buffer
+ *  Used by LNDPI_PACKET_BUFFER_POLICY_GIVEUP_OLDEST
+ */
+static enum lndpi_error lndpi_packet_buffer_flush_oldest(void)
+{
+    if (s_packet_buffer.head == NULL)
+        return LNDPI_PACKET_BUFFER_OVERFLOW;
+
+    struct lndpi_packet_flow* flow = s_packet_buffer.head->data.packet->lndpi_flow;
+
+    enum lndpi_error error;
+
+    if (!lndpi_packet_flow_detection_finished(flow))
+    {
+        ++s_stats.forced_giveups;
+
+        if ((error = lndpi_flow_giveup(s_ndpi_struct, flow)) != LNDPI_OK)
+            return error;
+    }
+
+    return lndpi_packet_buffer_drain(
+        s_ndpi_struct,
+        &s_packet_buffer,
+        s_flow_timeout_ms,
+        s_effective_max_packets_to_process
+    );
+}
+
+/**
+ *  Evict a flow from the full flow buffer
+ *  Used by LNDPI_FLOW_BUFFER_POLICY_EVICT
+ */
+static enum lndpi_error lndpi_flow_buffer_evict_one(void)
+{
+    enum lndpi_error error = LNDPI_OK;
+
+    struct lndpi_packet_flow* victim;
+
+    if ((victim = lndpi_flow_buffer_evict(&s_flow_buffer)) == NULL)
+        return LNDPI_FLOW_BUFFER_OVERFLOW;
+
+    ++s_stats.evicted_flows;
+
+    if (s_flow_eviction_callback != NULL && lndpi_flow_subscribed(victim))
+        error = s_flow_eviction_callback(
+            s_ndpi_struct,
+            victim,
+            s_flow_eviction_callback_parameter
+        );
+
+    lndpi_packet_flow_destroy(victim);
+
+    return error;
+}
+
+/**
+ *  Default finalize callback function
+ *  Send all packets from buffer to packet callback function
+ */
+static enum lndpi_error lndpi_packet_buffer_log(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_linked_list* flow_buffer,
+    struct lndpi_linked_list* packet_buffer,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    uint32_t max_flow_number,
+    void* parameter
+)
+{
+    enum lndpi_error error;
+
+    struct lndpi_linked_list_element* iter = packet_buffer->head;
+
+    struct lndpi_packet_struct* batch[LNDPI_PACKET_BATCH_SIZE];
+    uint32_t batch_size, emitted_num;
+
+    while (iter != NULL)
+    {
+        for (batch_size = 0; iter != NULL && batch_size < LNDPI_PACKET_BATCH_SIZE; iter = iter->next)
+        {
+            if (!lndpi_packet_flow_detection_finished(iter->data.packet->lndpi_flow)
+                && (error = lndpi_flow_giveup(ndpi_struct, iter->data.packet->lndpi_flow)) != LNDPI_OK)
+                return error;
+
+            batch[batch_size++] = iter->data.packet;
+        }
+
+        if ((error = lndpi_emit_packets(
+            ndpi_struct,
+            batch,
+            batch_size,
+            timeout_ms,
+            max_packets_to_process,
+            &emitted_num)
+        ) != LNDPI_OK)
+            return error;
+    }
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Preallocate pools for flows, packets and buffer elements
+ *  Every flow takes two nDPI id structs and one flow buffer element
+ */
+static enum lndpi_error lndpi_memory_pools_init(void)
+{
+    enum lndpi_error error;
+
+    if ((error = lndpi_memory_pool_init(
+        LNDPI_MEMORY_POOL_FLOWS,
+        sizeof(struct lndpi_packet_flow),
+        s_max_flow_number,
+        s_memory_backing)
+    ) != LNDPI_OK)
+        return error;
+
+    if ((error = lndpi_memory_pool_init(
+        LNDPI_MEMORY_POOL_NDPI_FLOWS,
+        SIZEOF_FLOW_STRUCT,
+        s_max_flow_number,
+        s_memory_backing)
+    ) != LNDPI_OK)
+        return error;
+
+    /* Id structs are either held by host entries or owned by flows */
+    if (s_host_table_size > 0)
+        error = lndpi_memory_pool_init(
+            LNDPI_MEMORY_POOL_ID_STRUCTS,
+            LNDPI_HOST_ENTRY_SIZE,
+            s_host_table_size,
+            s_memory_backing);
+    else
+        error = lndpi_memory_pool_init(
+            LNDPI_MEMORY_POOL_ID_STRUCTS,
+            SIZEOF_ID_STRUCT,
+            2 * s_max_flow_number,
+            s_memory_backing);
+
+    if (error != LNDPI_OK)
+        return error;
+
+    if ((error = lndpi_memory_pool_init(
+        LNDPI_MEMORY_POOL_PACKETS,
+        sizeof(struct lndpi_packet_struct),
+        s_packet_buffer_size,
+        s_memory_backing)
+    ) != LNDPI_OK)
+        return error;
+
+    return lndpi_memory_pool_init(
+        LNDPI_MEMORY_POOL_LIST_ELEMENTS,
+        sizeof(struct lndpi_linked_list_element),
+        s_max_flow_number + s_packet_buffer_size,
+        s_memory_backing
+    );
+}
+
+/**
+ *  Library initialization function definition
+ */
+enum lndpi_error lndpi_packet_lib_init(
+    uint32_t max_flow_number,
+    uint32_t max_packets_to_process,
+    uint32_t packet_buffer_size,
+    uint64_t flow_timeout_ms
+) {
+    s_max_flow_number = max_flow_number;
+    s_max_packets_to_process = max_packets_to_process;
+    s_effective_max_packets_to_process = max_packets_to_process;
+    s_effective_max_packet_hold_ms = s_max_packet_hold_ms;
+    s_packet_buffer_size = packet_buffer_size;
+    s_flow_timeout_ms = flow_timeout_ms;
+
+    memset(&s_stats, 0, sizeof(s_stats));
+
+    lndpi_frame_block_reset_max_pinned_num();
+
+    enum lndpi_error error;
+
+    /* Bind to the NUMA node before anything is allocated */
+    int32_t numa_node = s_numa_interface_name != NULL
+        ? lndpi_numa_interface_node(s_numa_interface_name)
+        : s_numa_node;
+
+    s_stats.numa_node = -1;
+
+    if (numa_node >= 0)
+    {
+        if ((error = lndpi_numa_bind_thread(numa_node, &s_stats.numa_cpus)) != LNDPI_OK)
+            return error;
+
+        s_stats.numa_node = numa_node;
+    }
+
+    struct timespec init_start, init_end;
+
+    clock_gettime(CLOCK_MONOTONIC, &init_start);
+
+    if ((error = lndpi_detection_module_init()) != LNDPI_OK)
+        return error;
+
+    clock_gettime(CLOCK_MONOTONIC, &init_end);
+
+    s_stats.detection_module_init_us = (uint64_t)(init_end.tv_sec - init_start.tv_sec) * 1000000
+        + (init_end.tv_nsec - init_start.tv_nsec) / 1000;
+
+    if ((error = lndpi_memory_pools_init()) != LNDPI_OK)
+        return error;
+
+    if (s_stats.numa_node >= 0
+        && (error = lndpi_memory_pool_bind(s_stats.numa_node)) != LNDPI_OK)
+        return error;
+
+    if (s_host_table_size > 0)
+    {
+        if ((error = lndpi_host_table_init(
+            &s_host_table,
+            s_host_table_size,
+            s_host_table_ttl_ms)
+        ) != LNDPI_OK)
+            return error;
+
+        lndpi_packet_flow_set_host_table(&s_host_table);
+    }
+
+    if ((error = lndpi_flow_buffer_init(s_max_flow_number)) != LNDPI_OK)
+        return error;
+
+    lndpi_packet_buffer_init(s_packet_buffer_size);
+
+    if (s_flow_query_enabled
+        && (error = lndpi_flow_query_init(&s_flow_query, s_max_flow_number)) != LNDPI_OK)
+        return error;
+
+    if (s_endpoint_cache_size > 0
+        && (error = lndpi_endpoint_cache_init(
+            &s_endpoint_cache,
+            s_endpoint_cache_size,
+            s_endpoint_cache_ttl_ms)
+        ) != LNDPI_OK)
+        return error;
+
+    if (s_ip_fragments_size > 0
+        && (error = lndpi_ip_fragments_init(
+            &s_ip_fragments,
+            s_ip_fragments_size,
+            s_ip_fragments_ttl_ms,
+            s_ip_max_datagram_size)
+        ) != LNDPI_OK)
+        return error;
+
+    if (s_flow_snapshot_file_path != NULL
+        && (error = lndpi_flow_snapshot_load(
+            &s_flow_buffer,
+            s_flow_snapshot_file_path,
+            lndpi_flow_hibernate,
+            &s_stats.restored_flows)
+        ) != LNDPI_OK)
+        return error;
+
+    s_buffers_callback = lndpi_process_buffers;
+    s_buffers_callback_parameter = NULL;
+
+    s_packet_callback = lndpi_log_packet;
+    s_packet_callback_parameter = NULL;
+
+    s_packet_batch_callback = NULL;
+    s_packet_batch_callback_parameter = NULL;
+
+    s_finalize_callback = lndpi_packet_buffer_log;
+    s_finalize_callback_parameter = NULL;
+
+    s_flow_eviction_callback = NULL;
+    s_flow_eviction_callback_parameter = NULL;
+
+    s_flow_verdict_callback = NULL;
+    s_flow_verdict_callback_parameter = NULL;
+
+    s_packets_since_housekeeping = 0;
+    s_last_housekeeping_ms = lndpi_current_time_ms();
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Default log file function definition
+ */
+enum lndpi_error lndpi_init_log_file(char* log_file_path)
+{
+    enum lndpi_error error;
+
+    if (LNDPI_PACKET_CALLBACK == lndpi_log_packet)
+        if ((error = lndpi_logger_init(log_file_path)) != LNDPI_OK)
+            return error;
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Finalize function definition
+ */
+enum lndpi_error lndpi_packet_lib_finalize(void)
+{
+    return s_finalize_callback(
+        s_ndpi_struct,
+        &s_flow_buffer,
+        &s_packet_buffer,
+        s_flow_timeout_ms,
+        s_effective_max_packets_to_process,
+        s_max_flow_number,
+        s_finalize_callback_parameter
+    );
+}
+
+/**
+ *  Library exit funtion definition
+ */
+void lndpi_packet_lib_exit(void)
+{
+    lndpi_logger_exit();
+
+    ndpi_exit_detection_module(s_ndpi_struct);
+
+    lndpi_flow_buffer_clear(&s_flow_buffer);
+
+    lndpi_flow_buffer_index_exit(&s_flow_buffer);
+
+    lndpi_flow_query_exit(&s_flow_query);
+
+    lndpi_packet_buffer_clear(&s_packet_buffer);
+
+    lndpi_endpoint_cache_exit(&s_endpoint_cache);
+
+    lndpi_ip_fragments_exit(&s_ip_fragments);
+
+    lndpi_packet_flow_set_host_table(NULL);
+
+    lndpi_host_table_exit(&s_host_table);
+
+    lndpi_memory_pool_exit();
+}
+
+/**
+ *  Structure to extract source and destination ports from L4 header
+ */
+struct l4_header_addr
+{
+    uint16_t src_port;
+    uint16_t dst_port;
+};
+
+/**
+ *  Check if packet has L4 header
+ *  Currently only check if L4 protocol is TCP or UPD
+ */
+static uint8_t lndpi_packet_has_l4header(struct ndpi_iphdr* iph)
+{
+    return (iph->protocol == IPPROTO_TCP
+        || iph->protocol == IPPROTO_UDP);
+}
+
+/**
+ *  Check if a packet of a flow should be passed to nDPI
+ *  Flows which got protocol from a snapshot or an endpoint cache,
+ *  whose detection was given up or which are hibernated are never passed to nDPI
+ */
+static uint8_t lndpi_flow_needs_detection(struct lndpi_packet_flow* flow)
+{
+    if (flow->restored || flow->protocol_from_cache || flow->detection_given_up
+        || lndpi_packet_flow_hibernated(flow))
+        return 0;
+
+    return flow->protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN
+        || ndpi_extra_dissection_possible(s_ndpi_struct, flow->ndpi_flow);
+}
+
+/**
+ *  Structure to keep header information of a packet between parsing and processing
+ *  Only fields checked against the captured length by lndpi_packet_parse() are read later
+ */
+struct lndpi_packet_header
+{
+    struct ndpi_iphdr* iph;                 /* Pointer to L3 header */
+    uint16_t l3_length;                     /* Captured bytes of the IP datagram up to its total length */
+    uint8_t tcp_flags;                      /* TCP flags if has_tcp_flags is set */
+    uint8_t has_tcp_flags;                  /* 1 if TCP header with flags was captured; 0 otherwise */
+    uint64_t time_ms;                       /* Timestamp for arrival */
+    struct in_addr src_addr;                /* Source IP address */
+    struct in_addr dst_addr;                /* Destination IP address */
+    uint16_t src_port;                      /* Source port */
+    uint16_t dst_port;                      /* Destination port */
+    uint32_t hash;                          /* Hash of addresses */
+    enum lndpi_ip_fragment_type fragment;   /* IP fragmentation of the packet */
+    const struct tpacket3_hdr* pkt;         /* Original frame */
+    struct lndpi_frame_block* frame_block;  /* Block to pin if the packet is buffered or NULL */
+};
+
+/**
+ *  Count a rejected frame
+ */
+static enum lndpi_error lndpi_packet_reject(enum lndpi_error error)
+{
+    if (error == LNDPI_MALFORMED_PACKET)
+        LNDPI_STATS_INC(malformed_packets);
+    else if (error == LNDPI_NON_IP_PACKET)
+        LNDPI_STATS_INC(non_ip_packets);
+
+    return error;
+}
+
+/**
+ *  Find L3 header of a frame and the number of its captured bytes
+ *  L3 header starts at tp_net; only frames of Ethernet links (sll_hatype of the sockaddr_ll
+ *  the kernel puts after the frame header) are walked from there through the VLAN tags
+ *  left in the frame, since the kernel strips only the outer one into hv1
+ */
+static enum lndpi_error lndpi_packet_find_l3(
+    const struct tpacket3_hdr* pkt,
+    const uint8_t** l3,
+    uint32_t* l3_captured
+) {
+    const uint8_t* frame = (const uint8_t*)pkt + pkt->tp_mac;
+    uint32_t offset = pkt->tp_net - pkt->tp_mac;
+    uint8_t vlan = (pkt->tp_status & TP_STATUS_VLAN_VALID) != 0;
+
+    if (pkt->tp_net < pkt->tp_mac || offset >= pkt->tp_snaplen)
+        return LNDPI_MALFORMED_PACKET;
+
+    const struct sockaddr_ll* sll = (const struct sockaddr_ll*)
+        ((const uint8_t*)pkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+    if (pkt->tp_mac >= TPACKET3_HDRLEN && sll->sll_hatype == ARPHRD_ETHER && offset >= ETH_HLEN)
+    {
+        /* Type of the header at tp_net ends the L2 header; tags before it were already skipped by the kernel */
+        uint16_t ethertype = (uint16_t)(frame[offset - 2] << 8 | frame[offset - 1]);
+
+        if (LNDPI_VLAN_ETHERTYPE((uint16_t)(frame[12] << 8 | frame[13])))
+            vlan = 1;
+
+        while (LNDPI_VLAN_ETHERTYPE(ethertype))
+        {
+            if (offset + LNDPI_VLAN_HEADER_SIZE >= pkt->tp_snaplen)
+                return LNDPI_MALFORMED_PACKET;
+
+            ethertype = (uint16_t)(frame[offset + 2] << 8 | frame[offset + 3]);
+            offset += LNDPI_VLAN_HEADER_SIZE;
+            vlan = 1;
+        }
+
+        if (vlan)
+            LNDPI_STATS_INC(vlan_packets);
+
+        if (!LNDPI_IP_ETHERTYPE(ethertype))
+            return LNDPI_NON_IP_PACKET;
+    } else if (vlan)
+        LNDPI_STATS_INC(vlan_packets);
+
+    *l3 = frame + offset;
+    *l3_captured = pkt->tp_snaplen - offset;
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Extract addresses from a packet and compute their hash
+ *  Every header field used by processing is checked against tp_snaplen
+ */
+static enum lndpi_error lndpi_packet_parse(
+    const struct tpacket3_hdr* pkt,
+    struct lndpi_packet_header* header
+) {
+    enum lndpi_error error;
+
+    const uint8_t* l3;
+    uint32_t l3_captured;
+
+    if ((error = lndpi_packet_find_l3(pkt, &l3, &l3_captured)) != LNDPI_OK)
+        return lndpi_packet_reject(error);
+
+    struct ndpi_iphdr* iph = (struct ndpi_iphdr*)l3;
+
+#ifndef LNDPI_NO_IPV6
+    /* IPv6 is not supported yet */
+    if (iph->version == 6)
+        return LNDPI_IPV6_NOT_SUPPORTED;
+#endif
+
+    if (iph->version != 4)
+        return lndpi_packet_reject(LNDPI_NON_IP_PACKET);
+
+    uint32_t header_length = iph->ihl * 4, total_length;
+
+    if (l3_captured < sizeof(struct ndpi_iphdr)
+        || header_length < sizeof(struct ndpi_iphdr)
+        || header_length > l3_captured
+        || (total_length = ntohs(iph->tot_len)) < header_length)
+        return lndpi_packet_reject(LNDPI_MALFORMED_PACKET);
+
+    header->iph = iph;
+    header->l3_length = (uint16_t)(total_length < l3_captured ? total_length : l3_captured);
+    header->pkt = pkt;
+    header->frame_block = NULL;
+    header->time_ms = (uint64_t)pkt->tp_sec * 1000 + pkt->tp_nsec / 1000000;
+
+    header->fragment = lndpi_ip_fragment_type(iph);
+
+    /* Ports must be captured unless they are taken from the first fragment */
+    uint8_t has_ports = header->fragment != LNDPI_IP_NEXT_FRAGMENT && lndpi_packet_has_l4header(iph);
+
+    if (has_ports && header_length + sizeof(struct l4_header_addr) > header->l3_length)
+        return lndpi_packet_reject(LNDPI_MALFORMED_PACKET);
+
+    header->has_tcp_flags = iph->protocol == IPPROTO_TCP
+        && header->fragment != LNDPI_IP_NEXT_FRAGMENT
+        && header_length + LNDPI_TCP_FLAGS_OFFSET < header->l3_length;
+    header->tcp_flags = header->has_tcp_flags ? l3[header_length + LNDPI_TCP_FLAGS_OFFSET] : 0;
+
+    /* Get address information from packet */
+    header->src_addr.s_addr = iph->saddr;
+    header->dst_addr.s_addr = iph->daddr;
+
+    header->src_port = 0;
+    header->dst_port = 0;
+
+    if (header->fragment != LNDPI_IP_NOT_FRAGMENT)
+        LNDPI_STATS_INC(ip_fragments);
+
+    if (header->fragment == LNDPI_IP_NEXT_FRAGMENT)
+    {
+        /* L4 header is only in the first fragment; take its ports for the rest */
+        if (s_ip_fragments.entries == NULL
+            || !lndpi_ip_fragments_find_ports(
+                &s_ip_fragments,
+                iph,
+                header->time_ms,
+                &header->src_port,
+                &header->dst_port))
+            LNDPI_STATS_INC(orphan_ip_fragments);
+    } else if (has_ports)
+    {
+        const struct l4_header_addr* l4addr = (const struct l4_header_addr*)(l3 + header_length);
+
+        header->src_port = ntohs(l4addr->src_port);
+        header->dst_port = ntohs(l4addr->dst_port);
+
+        if (header->fragment == LNDPI_IP_FIRST_FRAGMENT && s_ip_fragments.entries != NULL)
+            lndpi_ip_fragments_put_ports(
+                &s_ip_fragments,
+                iph,
+                header->src_port,
+                header->dst_port,
+                header->time_ms
+            );
+    }
+
+    header->hash = lndpi_packet_flow_hash(
+        header->src_addr,
+        header->dst_addr,
+        header->src_port,
+        header->dst_port
+    );
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Choose data to pass to nDPI for a packet
+ *  Fragments are passed as reassembled datagrams if reassembly is enabled;
+ *  otherwise only the first fragment, which carries L4 header, is passed
+ *  Fragments truncated by snaplen are never reassembled so that a datagram is not completed with holes
+ */
+static uint8_t lndpi_packet_detection_data(
+    const struct lndpi_packet_header* header,
+    uint16_t length,
+    const uint8_t** data,
+    uint16_t* data_length
+) {
+    if (header->fragment != LNDPI_IP_NOT_FRAGMENT
+        && s_ip_fragments.entries != NULL
+        && s_ip_fragments.max_datagram_size > 0
+        && length == ntohs(header->iph->tot_len))
+    {
+        if (!lndpi_ip_fragments_reassemble(
+            &s_ip_fragments,
+            header->iph,
+            length,
+            header->time_ms,
+            data,
+            data_length))
+            return 0;
+
+        LNDPI_STATS_INC(reassembled_ip_datagrams);
+
+        return 1;
+    }
+
+    if (header->fragment == LNDPI_IP_NEXT_FRAGMENT)
+        return 0;
+
+    *data = (const uint8_t*)header->iph;
+    *data_length = length;
+
+    return 1;
+}
+
+/**
+ *  Update memory pressure level and apply its limits
+ *  Level goes down only when usage is 5% below its threshold
+ */
+static void lndpi_memory_pressure_update(void)
+{
+    static const uint8_t thresholds[] = { 0, 70, 85, 95 };
+
+    s_stats.memory_usage = lndpi_memory_usage();
+
+    if (s_memory_budget == 0)
+        return;
+
+    uint64_t percent = s_stats.memory_usage * 100 / s_memory_budget;
+    enum lndpi_memory_pressure level = s_stats.memory_pressure;
+
+    while (level < LNDPI_MEMORY_PRESSURE_CRITICAL && percent >= thresholds[level + 1])
+        ++level;
+
+    while (level > LNDPI_MEMORY_PRESSURE_NONE && percent + 5 < thresholds[level])
+        --level;
+
+    if (level == s_stats.memory_pressure)
+        return;
+
+    if (level > s_stats.memory_pressure)
+        ++s_stats.memory_pressure_rises;
+
+    s_stats.memory_pressure = level;
+
+    /* Each level halves detection effort and hold time */
+    uint64_t hold_base_ms = s_max_packet_hold_ms > 0 ? s_max_packet_hold_ms : s_flow_timeout_ms;
+
+    s_effective_max_packets_to_process = s_max_packets_to_process >> level;
+    if (s_effective_max_packets_to_process == 0)
+        s_effective_max_packets_to_process = 1;
+
+    if (level == LNDPI_MEMORY_PRESSURE_NONE)
+        s_effective_max_packet_hold_ms = s_max_packet_hold_ms;
+    else if ((s_effective_max_packet_hold_ms = hold_base_ms >> level) == 0)
+        s_effective_max_packet_hold_ms = 1;
+}
+
+/**
+ *  Give up detection of flows with the oldest buffered packets under high memory pressure
+ *  Their packets are released by the following drain
+ */
+static enum lndpi_error lndpi_memory_pressure_giveup(void)
+{
+    enum lndpi_error error;
+
+    if (s_stats.memory_pressure < LNDPI_MEMORY_PRESSURE_HIGH)
+        return LNDPI_OK;
+
+    uint32_t limit = s_stats.memory_pressure == LNDPI_MEMORY_PRESSURE_CRITICAL
+        ? s_packet_buffer.elements_number
+        : LNDPI_MEMORY_PRESSURE_GIVEUP_SCAN;
+
+    struct lndpi_linked_list_element* iter;
+    uint32_t scanned;
+
+    for (iter = s_packet_buffer.head, scanned = 0; iter != NULL && scanned < limit; iter = iter->next, ++scanned)
+    {
+        struct lndpi_packet_flow* flow = iter->data.packet->lndpi_flow;
+
+        if (lndpi_packet_flow_detection_finished(flow))
+            continue;
+
+        ++s_stats.pressure_giveups;
+
+        if ((error = lndpi_flow_giveup(s_ndpi_struct, flow)) != LNDPI_OK)
+            return error;
+    }
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Run the buffers callback function and restart housekeeping counters
+ *  Housekeeping is scheduled by the same wall clock which flow timeouts are checked against
+ */
+static enum lndpi_error lndpi_housekeeping(void)
+{
+    enum lndpi_error error;
+
+    uint64_t now_ms = lndpi_current_time_ms();
+
+    s_packets_since_housekeeping = 0;
+    s_last_housekeeping_ms = now_ms;
+
+    ++s_stats.housekeeping_runs;
+
+    lndpi_memory_pressure_update();
+
+    if ((error = lndpi_memory_pressure_giveup()) != LNDPI_OK)
+        return error;
+
+    if (s_host_table.buckets != NULL)
+        lndpi_host_table_expire(&s_host_table, now_ms);
+
+    return LNDPI_BUFFERS_CALLBACK(
+        s_ndpi_struct,
+        &s_flow_buffer,
+        &s_packet_buffer,
+        s_flow_timeout_ms,
+        s_effective_max_packets_to_process,
+        s_max_flow_number,
+        s_buffers_callback_parameter
+    );
+}
+
+/**
+ *  Check if housekeeping is due after a packet
+ *  The clock is read only if the time limit is set
+ */
+static uint8_t lndpi_housekeeping_due(void)
+{
+    if (s_housekeeping_packets > 0
+        && s_packets_since_housekeeping >= s_housekeeping_packets)
+        return 1;
+
+    if (s_housekeeping_interval_ms > 0
+        && lndpi_current_time_ms() >= s_last_housekeeping_ms + s_housekeeping_interval_ms)
+        return 1;
+
+    return 0;
+}
+
+/**
+ *  Process a packet which was parsed by lndpi_packet_parse()
+ */
+static enum lndpi_error lndpi_process_parsed_packet(struct lndpi_packet_header* header)
+{
+    enum lndpi_error error;
+
+    struct ndpi_iphdr* iph = header->iph;
+
+    /* Run deferred housekeeping before applying overload policies */
+    if (s_packets_since_housekeeping > 0
+        && (s_packet_buffer.elements_number >= s_packet_buffer.max_elements_number
+            || (s_flow_buffer_policy == LNDPI_FLOW_BUFFER_POLICY_ERROR
+                && s_flow_buffer.elements_number >= s_flow_buffer.max_elements_number))
+        && (error = lndpi_housekeeping()) != LNDPI_OK)
+        return error;
+
+    /* Set if the packet is emitted without detection by LNDPI_PACKET_BUFFER_POLICY_EMIT_UNCLASSIFIED */
+    uint8_t unclassified = 0;
+
+#ifdef LNDPI_NO_BUFFERING
+    /* Packets are never buffered; each one is emitted right after detection */
+    uint8_t emit_unbuffered = 1;
+#else
+    /* Apply overload policy if the packet buffer is full */
+    uint8_t emit_unbuffered = 0;
+
+    if (s_packet_buffer.elements_number >= s_packet_buffer.max_elements_number)
+    {
+        switch (s_packet_buffer_policy) {
+            case LNDPI_PACKET_BUFFER_POLICY_GIVEUP_OLDEST:
+                if ((error = lndpi_packet_buffer_flush_oldest()) != LNDPI_OK)
+                    return error;
+                break;
+            case LNDPI_PACKET_BUFFER_POLICY_DROP_NEWEST:
+                LNDPI_STATS_INC(dropped_packets);
+                return LNDPI_OK;
+            case LNDPI_PACKET_BUFFER_POLICY_EMIT_UNCLASSIFIED:
+                emit_unbuffered = unclassified = 1;
+                break;
+            default:
+                return LNDPI_PACKET_BUFFER_OVERFLOW;
+        }
+    }
+#endif
+
+    /* Check for corresponding flow in the buffer */
+    int8_t direction;
+    struct lndpi_packet_flow* pkt_flow = lndpi_flow_buffer_find(
+        &s_flow_buffer,
+        header->src_addr,
+        header->dst_addr,
+        header->src_port,
+        header->dst_port,
+        header->hash,
         &direction
     );
 
     /* If no, create a new one */
     if (pkt_flow == NULL)
     {
+        if (s_flow_buffer.elements_number >= s_flow_buffer.max_elements_number
+            && s_flow_buffer_policy == LNDPI_FLOW_BUFFER_POLICY_EVICT
+            && (error = lndpi_flow_buffer_evict_one()) != LNDPI_OK)
+            return error;
+
         if ((pkt_flow = lndpi_packet_flow_init(
-            &src_addr,
-            &dst_addr,
-            src_port,
-            dst_port,
+            &header->src_addr,
+            &header->dst_addr,
+            header->src_port,
+            header->dst_port,
             iph->protocol
         )) == NULL)
             return LNDPI_OUT_OF_MEMORY;
 
         if ((error = lndpi_flow_buffer_put(&s_flow_buffer, pkt_flow)) != LNDPI_OK)
+        {
+            lndpi_packet_flow_destroy(pkt_flow);
+
             return error;
+        }
 
         direction = 1;
+
+        /* Take protocol of a recently classified flow to the same server */
+        if (s_endpoint_cache.entries != NULL)
+        {
+            struct in_addr server_addr;
+            uint16_t server_port;
+
+            lndpi_flow_server_endpoint(pkt_flow, &server_addr, &server_port);
+
+            if (lndpi_endpoint_cache_find(
+                &s_endpoint_cache,
+                server_addr,
+                server_port,
+                pkt_flow->ip_protocol,
+                header->time_ms,
+                &pkt_flow->protocol))
+            {
+                pkt_flow->protocol_from_cache = 1;
+
+                if (s_flow_hibernation)
+                    lndpi_flow_hibernate(pkt_flow);
+
+                LNDPI_STATS_INC(endpoint_cache_hits);
+            } else
+                LNDPI_STATS_INC(endpoint_cache_misses);
+        }
+    }
+
+    /* Earlier packets of the flow are still buffered; give up the oldest flow
+       and buffer this packet behind them to keep the flow's packets in order */
+    if (unclassified && pkt_flow->buffered_packets_num > 0)
+    {
+        if ((error = lndpi_packet_buffer_flush_oldest()) != LNDPI_OK)
+            return error;
+
+        emit_unbuffered = unclassified = 0;
     }
 
+    /* Track TCP lifecycle to expire closed connections early */
+    if (header->has_tcp_flags
+        && lndpi_packet_flow_update_tcp_state(pkt_flow, header->tcp_flags, direction))
+        LNDPI_STATS_INC(closed_tcp_flows);
+
+    /* Packets of flows which are not subscribed are neither buffered nor passed to callbacks */
+    uint8_t unsubscribed = !lndpi_flow_subscribed(pkt_flow);
+
     /* Create a new packet structure */
-    struct lndpi_packet_struct* packet;
+    struct lndpi_packet_struct* packet, unbuffered_packet;
 
-    if ((packet = (struct lndpi_packet_struct*)ndpi_malloc(sizeof(struct lndpi_packet_struct))) == NULL)
+    if (emit_unbuffered || unsubscribed)
+        packet = &unbuffered_packet;
+    else if ((packet = (struct lndpi_packet_struct*)lndpi_memory_pool_alloc(
+        LNDPI_MEMORY_POOL_PACKETS,
+        sizeof(struct lndpi_packet_struct))) == NULL)
         return LNDPI_OUT_OF_MEMORY;
 
-    packet->time_ms = (uint64_t)pkt->tp_sec * 1000 + pkt->tp_nsec / 1000000;
+    packet->time_ms = header->time_ms;
     packet->lndpi_flow = pkt_flow;
     packet->length = ntohs(iph->tot_len);
     packet->direction = direction;
+    packet->frame = header->frame_block != NULL ? header->pkt : NULL;
+    packet->frame_block = NULL;
+    packet->provisional = 0;
 
     /* Put it in a buffer */
-    if ((error = lndpi_packet_buffer_put(&s_packet_buffer, packet)) != LNDPI_OK)
-        return error;
+    if (!emit_unbuffered && !unsubscribed)
+    {
+        if ((error = lndpi_packet_buffer_put(&s_packet_buffer, packet)) != LNDPI_OK)
+        {
+            ndpi_free(packet);
+
+            return error;
+        }
+
+        /* Keep the frame's block out of the kernel while the packet is buffered */
+        if (header->frame_block != NULL)
+        {
+            packet->frame_block = header->frame_block;
+
+            lndpi_frame_block_ref(packet->frame_block);
+        }
+    }
 
     /* Invoke detection process if the protocol is unknown or some extra dissection possible */
-    if (pkt_flow->protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN
-        || ndpi_extra_dissection_possible(s_ndpi_struct, pkt_flow->ndpi_flow))
+    const uint8_t* detection_data;
+    uint16_t detection_length;
+
+    if (!unclassified
+        && lndpi_flow_needs_detection(pkt_flow)
+        && lndpi_packet_detection_data(header, header->l3_length, &detection_data, &detection_length))
     {
+        ndpi_protocol prev_protocol = pkt_flow->protocol;
+
         struct ndpi_id_struct* src, * dst;
 
         if (direction == 1)
@@ -388,28 +1894,174 @@ enum lndpi_error lndpi_process_packet(const struct tpacket3_hdr* pkt)
         pkt_flow->protocol = ndpi_detection_process_packet(
             s_ndpi_struct,
             pkt_flow->ndpi_flow,
-            (uint8_t*)iph,
-            packet->length,
+            detection_data,
+            detection_length,
             packet->time_ms,
             src,
             dst
         );
 
         pkt_flow->processed_packets_num++;
+
+        /* Extra dissection may refine the verdict */
+        if (prev_protocol.master_protocol != pkt_flow->protocol.master_protocol
+            || prev_protocol.app_protocol != pkt_flow->protocol.app_protocol)
+            pkt_flow->subscription = LNDPI_SUBSCRIPTION_UNKNOWN;
+
+        if (prev_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN
+            && pkt_flow->protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN
+            && (error = lndpi_flow_verdict_final(s_ndpi_struct, pkt_flow)) != LNDPI_OK)
+            return error;
+
+        /* The verdict can't be refined once nDPI has nothing more to look at */
+        if (pkt_flow->protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN
+            && !ndpi_extra_dissection_possible(s_ndpi_struct, pkt_flow->ndpi_flow))
+        {
+            lndpi_flow_remember_endpoint(pkt_flow, packet->time_ms);
+
+            /* Keep only the slim flow record */
+            if (s_flow_hibernation)
+                lndpi_flow_hibernate(pkt_flow);
+        }
     }
 
+#ifdef LNDPI_NO_BUFFERING
+    /* No packet buffer drain sees the flow, so detection is given up here on the same limits */
+    if (!lndpi_packet_flow_detection_finished(pkt_flow)
+        && (pkt_flow->processed_packets_num > s_effective_max_packets_to_process
+            || (pkt_flow->packets_num > 0 && lndpi_packet_flow_check_timeout(pkt_flow, s_flow_timeout_ms)))
+        && (error = lndpi_flow_giveup(s_ndpi_struct, pkt_flow)) != LNDPI_OK)
+        return error;
+#endif
+
     pkt_flow->last_packet_ms = packet->time_ms;
+    pkt_flow->packets_num++;
+    pkt_flow->bytes_num += packet->length;
 
-    /* Call the buffers callback funtion */
-    error = s_buffers_callback(
-        s_ndpi_struct,
-        &s_flow_buffer,
-        &s_packet_buffer,
-        s_flow_timeout_ms,
-        s_max_packets_to_process,
-        s_max_flow_number,
-        s_buffers_callback_parameter
-    );
+    lndpi_flow_publish(pkt_flow);
+
+    /* Pass the packet straight to the packet callback if it was not buffered */
+    if (unsubscribed)
+        LNDPI_STATS_INC(unsubscribed_packets);
+    else if (emit_unbuffered)
+    {
+        uint32_t emitted_num;
+
+        /* Packets of flows with final protocol decision are emitted with their verdict;
+           others are provisional, so the flow verdict callback reports the final one */
+        if (!lndpi_packet_flow_detection_finished(pkt_flow))
+        {
+            if (unclassified)
+                LNDPI_STATS_INC(unclassified_packets);
+
+            lndpi_packet_mark_provisional(packet);
+        }
+
+        if ((error = lndpi_emit_packets(
+            s_ndpi_struct,
+            &packet,
+            1,
+            s_flow_timeout_ms,
+            s_effective_max_packets_to_process,
+            &emitted_num)
+        ) != LNDPI_OK)
+            return error;
+    }
+
+    /* Call the buffers callback funtion if housekeeping is due */
+    ++s_packets_since_housekeeping;
+
+    if (lndpi_housekeeping_due())
+        return lndpi_housekeeping();
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Main packet processing funtion definition
+ */
+enum lndpi_error lndpi_process_packet(const struct tpacket3_hdr* pkt)
+{
+    enum lndpi_error error;
+
+    struct lndpi_packet_header header;
+
+    if ((error = lndpi_packet_parse(pkt, &header)) != LNDPI_OK)
+        return error;
+
+    return lndpi_process_parsed_packet(&header);
+}
+
+/**
+ *  Poll function definition
+ */
+enum lndpi_error lndpi_poll(void)
+{
+    return lndpi_housekeeping();
+}
+
+/**
+ *  Block processing function definition
+ *  Packets are processed in groups of s_prefetch_depth:
+ *      - parse headers of the whole group and prefetch hash buckets
+ *      - prefetch first flows of the buckets
+ *      - look up flows and run detection
+ *  In zero-copy mode the block is given back to the kernel
+ *  when no buffered packet references it
+ */
+enum lndpi_error lndpi_process_block(struct tpacket_block_desc* block)
+{
+    enum lndpi_error error = LNDPI_OK, packet_error;
+
+    struct lndpi_packet_header headers[LNDPI_MAX_PREFETCH_DEPTH];
+    enum lndpi_error parse_errors[LNDPI_MAX_PREFETCH_DEPTH];
+
+    struct lndpi_frame_block* frame_block = NULL;
+
+    if (s_zero_copy && (frame_block = lndpi_frame_block_open(block)) == NULL)
+        error = LNDPI_OUT_OF_MEMORY;
+
+    uint32_t remaining = block->hdr.bh1.num_pkts;
+    const struct tpacket3_hdr* pkt = (const struct tpacket3_hdr*)
+        ((const uint8_t*)block + block->hdr.bh1.offset_to_first_pkt);
+
+    while (remaining > 0)
+    {
+        uint32_t i, group_size = remaining < s_prefetch_depth ? remaining : s_prefetch_depth;
+
+        for (i = 0; i < group_size; ++i)
+        {
+            if ((parse_errors[i] = lndpi_packet_parse(pkt, &headers[i])) == LNDPI_OK)
+            {
+                headers[i].frame_block = frame_block;
+
+                lndpi_flow_buffer_prefetch_bucket(&s_flow_buffer, headers[i].hash);
+            }
+
+            pkt = (const struct tpacket3_hdr*)((const uint8_t*)pkt + pkt->tp_next_offset);
+        }
+
+        for (i = 0; i < group_size; ++i)
+            if (parse_errors[i] == LNDPI_OK)
+                lndpi_flow_buffer_prefetch_flow(&s_flow_buffer, headers[i].hash);
+
+        for (i = 0; i < group_size; ++i)
+        {
+            packet_error = parse_errors[i] == LNDPI_OK
+                ? lndpi_process_parsed_packet(&headers[i])
+                : parse_errors[i];
+
+            if (error == LNDPI_OK)
+                error = packet_error;
+        }
+
+        remaining -= group_size;
+    }
+
+    if (frame_block != NULL)
+        lndpi_frame_block_close(frame_block);
+    else if (s_zero_copy)
+        lndpi_frame_block_release(block);
 
     return error;
 }
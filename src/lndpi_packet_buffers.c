@@ -1,7 +1,71 @@
 #include "lndpi_packet_buffers.h"
+#include "lndpi_frame_block.h"
+#include "lndpi_memory_pool.h"
+
+#include <string.h>
+
+/* Max number of flows inspected by CLOCK hand to find an eviction victim */
+#define LNDPI_FLOW_EVICTION_SCAN_LIMIT 64
 
 /* */
 
+enum lndpi_error lndpi_flow_buffer_index_init(
+    struct lndpi_linked_list* flow_buffer,
+    uint32_t max_flow_number
+) {
+    uint32_t buckets_number = 1;
+
+    while (buckets_number < max_flow_number && buckets_number < (1u << 31))
+        buckets_number <<= 1;
+
+    if ((flow_buffer->buckets = (struct lndpi_packet_flow**)ndpi_malloc(
+        buckets_number * sizeof(struct lndpi_packet_flow*))) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+    memset(flow_buffer->buckets, 0, buckets_number * sizeof(struct lndpi_packet_flow*));
+
+    flow_buffer->buckets_mask = buckets_number - 1;
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_flow_buffer_hot_cache_init(
+    struct lndpi_linked_list* flow_buffer,
+    uint32_t size
+) {
+    uint32_t slots_number = 1;
+
+    flow_buffer->hot_flows = NULL;
+    flow_buffer->hot_flows_mask = 0;
+    flow_buffer->hot_flow_hits = 0;
+    flow_buffer->hot_flow_misses = 0;
+
+    if (size == 0)
+        return LNDPI_OK;
+
+    while (slots_number < size && slots_number < (1u << 24))
+        slots_number <<= 1;
+
+    if ((flow_buffer->hot_flows = (struct lndpi_packet_flow**)ndpi_malloc(
+        slots_number * sizeof(struct lndpi_packet_flow*))) == NULL)
+        return LNDPI_OUT_OF_MEMORY;
+    memset(flow_buffer->hot_flows, 0, slots_number * sizeof(struct lndpi_packet_flow*));
+
+    flow_buffer->hot_flows_mask = slots_number - 1;
+
+    return LNDPI_OK;
+}
+
+void lndpi_flow_buffer_index_exit(struct lndpi_linked_list* flow_buffer)
+{
+    ndpi_free(flow_buffer->buckets);
+    ndpi_free(flow_buffer->hot_flows);
+
+    flow_buffer->buckets = NULL;
+    flow_buffer->buckets_mask = 0;
+    flow_buffer->hot_flows = NULL;
+    flow_buffer->hot_flows_mask = 0;
+}
+
 void lndpi_flow_buffer_clear(struct lndpi_linked_list* flow_buffer)
 {
     struct lndpi_linked_list_element* iter, * iter_next = NULL;
@@ -15,7 +79,14 @@ void lndpi_flow_buffer_clear(struct lndpi_linked_list* flow_buffer)
         ndpi_free(iter);
     }
 
-    flow_buffer->head = flow_buffer->tail = NULL;
+    flow_buffer->head = flow_buffer->tail = flow_buffer->clock_hand = NULL;
+    flow_buffer->elements_number = 0;
+
+    if (flow_buffer->buckets != NULL)
+        memset(flow_buffer->buckets, 0, (flow_buffer->buckets_mask + 1) * sizeof(struct lndpi_packet_flow*));
+
+    if (flow_buffer->hot_flows != NULL)
+        memset(flow_buffer->hot_flows, 0, (flow_buffer->hot_flows_mask + 1) * sizeof(struct lndpi_packet_flow*));
 }
 
 struct lndpi_packet_flow* lndpi_flow_buffer_find(
@@ -24,14 +95,42 @@ struct lndpi_packet_flow* lndpi_flow_buffer_find(
     struct in_addr dst_addr,
     uint16_t src_port,
     uint16_t dst_port,
+    uint32_t hash,
     int8_t* direction
 ) {
-    struct lndpi_linked_list_element* iter;
+    struct lndpi_packet_flow* iter;
+    struct lndpi_packet_flow** hot_slot = NULL;
+
+    if (flow_buffer->hot_flows != NULL)
+    {
+        hot_slot = &flow_buffer->hot_flows[hash & flow_buffer->hot_flows_mask];
+
+        if ((iter = *hot_slot) != NULL
+            && iter->hash == hash
+            && (*direction = lndpi_packet_flow_compare_with(
+                iter,
+                src_addr,
+                dst_addr,
+                src_port,
+                dst_port)))
+        {
+            ++flow_buffer->hot_flow_hits;
+
+            iter->referenced = 1;
+
+            return iter;
+        }
+
+        ++flow_buffer->hot_flow_misses;
+    }
 
-    for (iter = flow_buffer->head; iter != NULL; iter = iter->next)
+    for (iter = flow_buffer->buckets[hash & flow_buffer->buckets_mask]; iter != NULL; iter = iter->hash_next)
     {
+        if (iter->hash != hash)
+            continue;
+
         *direction = lndpi_packet_flow_compare_with(
-            iter->data.flow,
+            iter,
             src_addr,
             dst_addr,
             src_port,
@@ -39,15 +138,47 @@ struct lndpi_packet_flow* lndpi_flow_buffer_find(
         );
 
         if (*direction)
-            return iter->data.flow;
+        {
+            iter->referenced = 1;
+
+            if (hot_slot != NULL)
+                *hot_slot = iter;
+
+            return iter;
+        }
     }
 
     return NULL;
 }
 
+void lndpi_flow_buffer_prefetch_bucket(struct lndpi_linked_list* flow_buffer, uint32_t hash)
+{
+    __builtin_prefetch(&flow_buffer->buckets[hash & flow_buffer->buckets_mask]);
+
+    if (flow_buffer->hot_flows != NULL)
+        __builtin_prefetch(&flow_buffer->hot_flows[hash & flow_buffer->hot_flows_mask]);
+}
+
+void lndpi_flow_buffer_prefetch_flow(struct lndpi_linked_list* flow_buffer, uint32_t hash)
+{
+    struct lndpi_packet_flow* flow = NULL;
+
+    /* Hot flow is what lookup will touch first */
+    if (flow_buffer->hot_flows != NULL)
+        flow = flow_buffer->hot_flows[hash & flow_buffer->hot_flows_mask];
+
+    if (flow == NULL)
+        flow = flow_buffer->buckets[hash & flow_buffer->buckets_mask];
+
+    if (flow != NULL)
+        __builtin_prefetch(flow);
+}
+
 static struct lndpi_linked_list_element* lndpi_linked_list_new_element(void)
 {
-    return (struct lndpi_linked_list_element*)ndpi_malloc(sizeof(struct lndpi_linked_list_element));
+    return (struct lndpi_linked_list_element*)lndpi_memory_pool_alloc(
+        LNDPI_MEMORY_POOL_LIST_ELEMENTS,
+        sizeof(struct lndpi_linked_list_element));
 }
 
 static uint8_t lndpi_linked_list_put_new_element(struct lndpi_linked_list* list) {
@@ -60,12 +191,14 @@ static uint8_t lndpi_linked_list_put_new_element(struct lndpi_linked_list* list)
             return 2;
 
         list->head->next = NULL;
+        list->head->prev = NULL;
 
         list->tail = list->head;
     } else
     {
         if ((list->tail->next = lndpi_linked_list_new_element()) == NULL)
             return 2;
+        list->tail->next->prev = list->tail;
         list->tail = list->tail->next;
 
         list->tail->next = NULL;
@@ -89,56 +222,131 @@ enum lndpi_error lndpi_flow_buffer_put(
 
     flow_buffer->tail->data.flow = flow;
 
+    struct lndpi_packet_flow** bucket = &flow_buffer->buckets[flow->hash & flow_buffer->buckets_mask];
+
+    flow->hash_next = *bucket;
+    *bucket = flow;
+
+    /* Next packet of a new flow is likely to follow soon */
+    if (flow_buffer->hot_flows != NULL)
+        flow_buffer->hot_flows[flow->hash & flow_buffer->hot_flows_mask] = flow;
+
     return LNDPI_OK;
 }
 
-static void lndpi_flow_buffer_erase(
-    struct lndpi_linked_list* list,
-    struct lndpi_linked_list_element* prev_element
+static void lndpi_flow_buffer_unlink(
+    struct lndpi_linked_list* flow_buffer,
+    struct lndpi_packet_flow* flow
 ) {
-    if (prev_element == list->tail)
-        return;
+    struct lndpi_packet_flow** iter;
 
-    struct lndpi_linked_list_element* erased;
+    if (flow_buffer->hot_flows != NULL
+        && flow_buffer->hot_flows[flow->hash & flow_buffer->hot_flows_mask] == flow)
+        flow_buffer->hot_flows[flow->hash & flow_buffer->hot_flows_mask] = NULL;
 
-    if (prev_element == NULL)
+    for (iter = &flow_buffer->buckets[flow->hash & flow_buffer->buckets_mask]; *iter != NULL; iter = &(*iter)->hash_next)
     {
-        if (list->head == list->tail)
-            list->tail = NULL;
+        if (*iter == flow)
+        {
+            *iter = flow->hash_next;
+
+            return;
+        }
+    }
+}
 
-        erased = list->head;
+/**
+ *  Remove an element from a flow buffer and return its flow
+ */
+static struct lndpi_packet_flow* lndpi_flow_buffer_remove(
+    struct lndpi_linked_list* list,
+    struct lndpi_linked_list_element* element
+) {
+    if (element->prev == NULL)
+        list->head = element->next;
+    else
+        element->prev->next = element->next;
 
-        list->head = list->head->next;
-    } else
-    {
-        erased = prev_element->next;
-        prev_element->next = prev_element->next->next;
+    if (element->next == NULL)
+        list->tail = element->prev;
+    else
+        element->next->prev = element->prev;
 
-        if (prev_element->next == list->tail)
-            list->tail = prev_element;
-    }
+    if (list->clock_hand == element)
+        list->clock_hand = element->next;
 
     --list->elements_number;
 
-    lndpi_packet_flow_destroy(erased->data.flow);
-    ndpi_free(erased);
+    struct lndpi_packet_flow* flow = element->data.flow;
+
+    lndpi_flow_buffer_unlink(list, flow);
+
+    ndpi_free(element);
+
+    return flow;
 }
 
 void lndpi_flow_buffer_cleanup(struct lndpi_linked_list* flow_buffer, uint64_t timeout_ms)
 {
-    struct lndpi_linked_list_element* iter, * prev_iter = NULL;
+    struct lndpi_linked_list_element* iter, * iter_next;
 
-    for (iter = flow_buffer->head; iter != NULL; iter = iter->next)
+    for (iter = flow_buffer->head; iter != NULL; iter = iter_next)
     {
-        if (iter->data.flow->protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN
+        iter_next = iter->next;
+
+        if (lndpi_packet_flow_detection_finished(iter->data.flow)
             && iter->data.flow->buffered_packets_num == 0
             && lndpi_packet_flow_check_timeout(iter->data.flow, timeout_ms))
         {
-            lndpi_flow_buffer_erase(flow_buffer, prev_iter);
+            lndpi_packet_flow_destroy(lndpi_flow_buffer_remove(flow_buffer, iter));
+        }
+    }
+}
+
+struct lndpi_packet_flow* lndpi_flow_buffer_evict(struct lndpi_linked_list* flow_buffer)
+{
+    struct lndpi_linked_list_element* iter = flow_buffer->clock_hand, * victim = NULL, * fallback = NULL;
+    uint32_t scanned;
+
+    for (scanned = 0; scanned < LNDPI_FLOW_EVICTION_SCAN_LIMIT && scanned < flow_buffer->elements_number; ++scanned)
+    {
+        if (iter == NULL)
+            iter = flow_buffer->head;
+
+        struct lndpi_packet_flow* flow = iter->data.flow;
+
+        /* Flows with buffered packets are never evicted */
+        if (flow->buffered_packets_num == 0)
+        {
+            if ((!flow->referenced || lndpi_packet_flow_tcp_closed(flow))
+                && lndpi_packet_flow_detection_finished(flow))
+            {
+                victim = iter;
+                break;
+            }
+
+            if (fallback == NULL)
+                fallback = iter;
         }
 
-        prev_iter = iter;
+        flow->referenced = 0;
+
+        iter = iter->next;
+    }
+
+    if (victim == NULL)
+        victim = fallback;
+
+    if (victim == NULL)
+    {
+        flow_buffer->clock_hand = iter;
+
+        return NULL;
     }
+
+    flow_buffer->clock_hand = victim->next;
+
+    return lndpi_flow_buffer_remove(flow_buffer, victim);
 }
 
 /* */
@@ -151,12 +359,16 @@ void lndpi_packet_buffer_clear(struct lndpi_linked_list* buffer)
     {
         iter_next = iter->next;
 
+        if (iter->data.packet->frame_block != NULL)
+            lndpi_frame_block_unref(iter->data.packet->frame_block);
+
         ndpi_free(iter->data.packet);
 
         ndpi_free(iter);
     }
 
     buffer->head = buffer->tail = NULL;
+    buffer->elements_number = 0;
 }
 
 enum lndpi_error lndpi_packet_buffer_put(
@@ -184,10 +396,16 @@ void lndpi_packet_buffer_advance(struct lndpi_linked_list* buffer)
 
         buffer->head = buffer->head->next;
 
+        if (buffer->head != NULL)
+            buffer->head->prev = NULL;
+
         --buffer->elements_number;
 
         --old_head->data.packet->lndpi_flow->buffered_packets_num;
 
+        if (old_head->data.packet->frame_block != NULL)
+            lndpi_frame_block_unref(old_head->data.packet->frame_block);
+
         ndpi_free(old_head->data.packet);
         ndpi_free(old_head);
     }
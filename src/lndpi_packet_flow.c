@@ -1,9 +1,30 @@
 #include "lndpi_packet_flow.h"
+#include "lndpi_memory_pool.h"
+#include "lndpi_host_table.h"
+#include "lndpi_flow_query.h"
 
 #include <sys/time.h>
 
 static uint32_t id_counter = 0;
 
+static uint64_t s_tcp_closed_timeout_ms = 0;
+static uint64_t s_tcp_half_open_timeout_ms = 0;
+
+static struct lndpi_host_table* s_host_table;
+
+static uint64_t s_state_bytes = 0;
+
+/* TCP header flags */
+#define LNDPI_TCP_FLAG_FIN 0x01
+#define LNDPI_TCP_FLAG_SYN 0x02
+#define LNDPI_TCP_FLAG_RST 0x04
+#define LNDPI_TCP_FLAG_ACK 0x10
+
+void lndpi_packet_flow_set_host_table(struct lndpi_host_table* table)
+{
+    s_host_table = table;
+}
+
 struct lndpi_packet_flow* lndpi_packet_flow_init(
     struct in_addr* src_addr,
     struct in_addr* dst_addr,
@@ -12,13 +33,17 @@ struct lndpi_packet_flow* lndpi_packet_flow_init(
     uint8_t ip_protocol
 ) {
     struct lndpi_packet_flow* res;
-    if ((res = (struct lndpi_packet_flow*)ndpi_malloc(sizeof(struct lndpi_packet_flow))) == NULL)
+    if ((res = (struct lndpi_packet_flow*)lndpi_memory_pool_alloc(
+        LNDPI_MEMORY_POOL_FLOWS,
+        sizeof(struct lndpi_packet_flow))) == NULL)
         return NULL;
     memset(res, 0, sizeof(struct lndpi_packet_flow));
 
     res->id = id_counter++;
 
-    if ((res->ndpi_flow = (struct ndpi_flow_struct*)ndpi_flow_malloc(SIZEOF_FLOW_STRUCT))
+    if ((res->ndpi_flow = (struct ndpi_flow_struct*)lndpi_memory_pool_alloc(
+        LNDPI_MEMORY_POOL_NDPI_FLOWS,
+        SIZEOF_FLOW_STRUCT))
             == NULL)
     {
         ndpi_free(res);
@@ -26,36 +51,87 @@ struct lndpi_packet_flow* lndpi_packet_flow_init(
         return NULL;
     }
     memset(res->ndpi_flow, 0, SIZEOF_FLOW_STRUCT);
+    s_state_bytes += SIZEOF_FLOW_STRUCT;
 
-    if ((res->src_id_struct = (struct ndpi_id_struct*)ndpi_malloc(SIZEOF_ID_STRUCT))
-            == NULL)
-    {
-        lndpi_packet_flow_destroy(res);
+    res->src_addr = *src_addr;
+    res->dst_addr = *dst_addr;
 
-        return NULL;
-    }
-    if ((res->dst_id_struct = (struct ndpi_id_struct*)ndpi_malloc(SIZEOF_ID_STRUCT))
-            == NULL)
+    /* Hosts keep their id structs across flows */
+    if (s_host_table != NULL)
+    {
+        res->src_id_struct = lndpi_host_table_acquire(s_host_table, *src_addr);
+        res->dst_id_struct = lndpi_host_table_acquire(s_host_table, *dst_addr);
+    } else
     {
-        lndpi_packet_flow_destroy(res);
+        if ((res->src_id_struct = (struct ndpi_id_struct*)lndpi_memory_pool_alloc(
+            LNDPI_MEMORY_POOL_ID_STRUCTS,
+            SIZEOF_ID_STRUCT))
+                == NULL)
+        {
+            lndpi_packet_flow_destroy(res);
 
-        return NULL;
+            return NULL;
+        }
+        memset(res->src_id_struct, 0, SIZEOF_ID_STRUCT);
+        s_state_bytes += SIZEOF_ID_STRUCT;
+
+        if ((res->dst_id_struct = (struct ndpi_id_struct*)lndpi_memory_pool_alloc(
+            LNDPI_MEMORY_POOL_ID_STRUCTS,
+            SIZEOF_ID_STRUCT))
+                == NULL)
+        {
+            lndpi_packet_flow_destroy(res);
+
+            return NULL;
+        }
+        memset(res->dst_id_struct, 0, SIZEOF_ID_STRUCT);
+        s_state_bytes += SIZEOF_ID_STRUCT;
     }
-    memset(res->src_id_struct, 0, SIZEOF_ID_STRUCT);
-    memset(res->dst_id_struct, 0, SIZEOF_ID_STRUCT);
 
     res->protocol.master_protocol = NDPI_PROTOCOL_UNKNOWN;
     res->protocol.app_protocol = NDPI_PROTOCOL_UNKNOWN;
     res->ip_protocol = ip_protocol;
 
-    res->src_addr = *src_addr;
-    res->dst_addr = *dst_addr;
     res->src_port = src_port;
     res->dst_port = dst_port;
 
+    res->hash = lndpi_packet_flow_hash(*src_addr, *dst_addr, src_port, dst_port);
+
     return res;
 }
 
+static uint32_t lndpi_hash_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+uint32_t lndpi_packet_flow_hash(
+    struct in_addr src_addr,
+    struct in_addr dst_addr,
+    uint16_t src_port,
+    uint16_t dst_port
+) {
+    uint32_t lo_addr = src_addr.s_addr, hi_addr = dst_addr.s_addr;
+    uint16_t lo_port = src_port, hi_port = dst_port;
+
+    /* Order endpoints so both directions give the same hash */
+    if (lo_addr > hi_addr || (lo_addr == hi_addr && lo_port > hi_port))
+    {
+        lo_addr = dst_addr.s_addr;
+        hi_addr = src_addr.s_addr;
+        lo_port = dst_port;
+        hi_port = src_port;
+    }
+
+    return lndpi_hash_mix(lo_addr ^ lndpi_hash_mix(hi_addr ^ lndpi_hash_mix(((uint32_t)lo_port << 16) | hi_port)));
+}
+
 int8_t lndpi_packet_flow_compare_with(
     struct lndpi_packet_flow* pkt_flow1,
     struct in_addr src_addr,
@@ -78,25 +154,141 @@ int8_t lndpi_packet_flow_compare_with(
     return 0;
 }
 
-uint8_t lndpi_packet_flow_check_timeout(struct lndpi_packet_flow* flow, uint64_t timeout_ms)
+uint64_t lndpi_current_time_ms(void)
 {
     struct timeval tv;
     gettimeofday(&tv, NULL);
 
-    uint64_t packet_time = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - flow->last_packet_ms;
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void lndpi_packet_flow_set_tcp_timeouts(uint64_t closed_timeout_ms, uint64_t half_open_timeout_ms)
+{
+    s_tcp_closed_timeout_ms = closed_timeout_ms;
+    s_tcp_half_open_timeout_ms = half_open_timeout_ms;
+}
+
+uint8_t lndpi_packet_flow_update_tcp_state(struct lndpi_packet_flow* flow, uint8_t tcp_flags, int8_t direction)
+{
+    uint8_t was_closed = lndpi_packet_flow_tcp_closed(flow);
+
+    /* New connection with the same ports */
+    if (was_closed && (tcp_flags & (LNDPI_TCP_FLAG_SYN | LNDPI_TCP_FLAG_ACK)) == LNDPI_TCP_FLAG_SYN)
+    {
+        flow->tcp_state = 0;
+        was_closed = 0;
+    }
+
+    if (tcp_flags & LNDPI_TCP_FLAG_SYN)
+        flow->tcp_state |= LNDPI_TCP_SYN;
+
+    if (direction == -1)
+        flow->tcp_state |= LNDPI_TCP_REPLY;
+
+    if (tcp_flags & LNDPI_TCP_FLAG_FIN)
+        flow->tcp_state |= direction == 1 ? LNDPI_TCP_SRC_FIN : LNDPI_TCP_DST_FIN;
+
+    if (tcp_flags & LNDPI_TCP_FLAG_RST)
+        flow->tcp_state |= LNDPI_TCP_RST;
+
+    return !was_closed && lndpi_packet_flow_tcp_closed(flow);
+}
+
+uint8_t lndpi_packet_flow_tcp_closed(struct lndpi_packet_flow* flow)
+{
+    return (flow->tcp_state & LNDPI_TCP_RST)
+        || (flow->tcp_state & (LNDPI_TCP_SRC_FIN | LNDPI_TCP_DST_FIN)) == (LNDPI_TCP_SRC_FIN | LNDPI_TCP_DST_FIN);
+}
+
+/**
+ *  Get timeout of a flow according to its TCP lifecycle
+ */
+static uint64_t lndpi_packet_flow_timeout(struct lndpi_packet_flow* flow, uint64_t timeout_ms)
+{
+    uint64_t lifecycle_timeout_ms = 0;
+
+    if (flow->tcp_state == 0)
+        return timeout_ms;
+
+    if (lndpi_packet_flow_tcp_closed(flow))
+        lifecycle_timeout_ms = s_tcp_closed_timeout_ms;
+    else if ((flow->tcp_state & (LNDPI_TCP_SYN | LNDPI_TCP_REPLY)) == LNDPI_TCP_SYN
+        || (flow->tcp_state & (LNDPI_TCP_SRC_FIN | LNDPI_TCP_DST_FIN)))
+        lifecycle_timeout_ms = s_tcp_half_open_timeout_ms;
+
+    return lifecycle_timeout_ms > 0 && lifecycle_timeout_ms < timeout_ms ? lifecycle_timeout_ms : timeout_ms;
+}
+
+uint8_t lndpi_packet_flow_check_timeout(struct lndpi_packet_flow* flow, uint64_t timeout_ms)
+{
+    timeout_ms = lndpi_packet_flow_timeout(flow, timeout_ms);
+
+    uint64_t packet_time = lndpi_current_time_ms() - flow->last_packet_ms;
 
     return packet_time > timeout_ms;
 }
 
-void lndpi_packet_flow_destroy(struct lndpi_packet_flow* pkt_flow)
+uint8_t lndpi_packet_flow_detection_finished(struct lndpi_packet_flow* flow)
 {
-    if (pkt_flow != NULL)
+    return flow->protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN
+        || flow->detection_given_up;
+}
+
+uint32_t lndpi_packet_flow_hibernate(struct lndpi_packet_flow* pkt_flow)
+{
+    uint32_t freed_bytes = 0;
+
+    if (pkt_flow->ndpi_flow != NULL)
     {
         ndpi_flow_free(pkt_flow->ndpi_flow);
+        pkt_flow->ndpi_flow = NULL;
+        freed_bytes += SIZEOF_FLOW_STRUCT;
+    }
+
+    if (s_host_table != NULL)
+    {
+        lndpi_host_table_release(s_host_table, pkt_flow->src_id_struct, pkt_flow->last_packet_ms);
+        lndpi_host_table_release(s_host_table, pkt_flow->dst_id_struct, pkt_flow->last_packet_ms);
+    } else
+    {
+        if (pkt_flow->src_id_struct != NULL)
+        {
+            ndpi_free(pkt_flow->src_id_struct);
+            freed_bytes += SIZEOF_ID_STRUCT;
+        }
+
+        if (pkt_flow->dst_id_struct != NULL)
+        {
+            ndpi_free(pkt_flow->dst_id_struct);
+            freed_bytes += SIZEOF_ID_STRUCT;
+        }
+    }
+
+    pkt_flow->src_id_struct = NULL;
+    pkt_flow->dst_id_struct = NULL;
+
+    s_state_bytes -= freed_bytes;
+
+    return freed_bytes;
+}
+
+uint64_t lndpi_packet_flow_state_bytes(void)
+{
+    return s_state_bytes;
+}
 
-        ndpi_free(pkt_flow->src_id_struct);
+uint8_t lndpi_packet_flow_hibernated(struct lndpi_packet_flow* pkt_flow)
+{
+    return pkt_flow->ndpi_flow == NULL;
+}
+
+void lndpi_packet_flow_destroy(struct lndpi_packet_flow* pkt_flow)
+{
+    if (pkt_flow != NULL)
+    {
+        lndpi_packet_flow_hibernate(pkt_flow);
 
-        ndpi_free(pkt_flow->dst_id_struct);
+        lndpi_flow_query_remove(pkt_flow);
 
         ndpi_free(pkt_flow);
     }
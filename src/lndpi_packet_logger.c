@@ -54,7 +54,7 @@ enum lndpi_error lndpi_log_packet(
         packet->lndpi_flow->ip_protocol,
         &protocol_str[0],
         &category_str[0],
-        packet->lndpi_flow->protocol_was_guessed ? "Guessed" : "",
+        packet->provisional ? "Pending" : packet->lndpi_flow->protocol_was_guessed ? "Guessed" : "",
         packet->lndpi_flow->processed_packets_num
     ) < 0)
         return LNDPI_CANT_WRITE_TO_LOG_FILE;
@@ -66,4 +66,6 @@ void lndpi_logger_exit(void)
 {
     if (log_file != NULL)
         fclose(log_file);
+
+    log_file = NULL;
 }
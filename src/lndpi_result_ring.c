@@ -0,0 +1,269 @@
+#include "lndpi_result_ring.h"
+#include "lndpi_packet_flow.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(struct lndpi_result_record) == 64, "result record must fill a cache line");
+
+static size_t lndpi_result_ring_size(uint32_t records_number)
+{
+    return sizeof(struct lndpi_result_ring_header)
+        + (size_t)records_number * sizeof(struct lndpi_result_record);
+}
+
+enum lndpi_error lndpi_result_ring_create(
+    struct lndpi_result_ring* ring,
+    const char* name,
+    uint32_t records_number
+) {
+    uint32_t size = 1;
+    int fd;
+
+    while (size < records_number && size < (1u << 30))
+        size <<= 1;
+
+    ring->map_size = lndpi_result_ring_size(size);
+
+    if (strlen(name) >= sizeof(ring->name))
+        return LNDPI_CANT_OPEN_RESULT_RING;
+    strcpy(ring->name, name);
+
+    if ((fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644)) < 0)
+        return LNDPI_CANT_OPEN_RESULT_RING;
+
+    if (ftruncate(fd, ring->map_size) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+
+        return LNDPI_CANT_OPEN_RESULT_RING;
+    }
+
+    ring->header = (struct lndpi_result_ring_header*)mmap(
+        NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+
+    close(fd);
+
+    if (ring->header == MAP_FAILED)
+    {
+        ring->header = NULL;
+        shm_unlink(name);
+
+        return LNDPI_CANT_OPEN_RESULT_RING;
+    }
+
+    ring->records = (struct lndpi_result_record*)(ring->header + 1);
+    ring->mask = size - 1;
+    ring->write_seq = 0;
+
+    ring->header->record_size = sizeof(struct lndpi_result_record);
+    ring->header->records_number = size;
+    ring->header->version = LNDPI_RESULT_RING_VERSION;
+    __atomic_store_n(&ring->header->write_seq, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->header->magic, LNDPI_RESULT_RING_MAGIC, __ATOMIC_RELEASE);
+
+    return LNDPI_OK;
+}
+
+void lndpi_result_ring_destroy(struct lndpi_result_ring* ring)
+{
+    if (ring->header == NULL)
+        return;
+
+    munmap(ring->header, ring->map_size);
+    shm_unlink(ring->name);
+
+    ring->header = NULL;
+}
+
+void lndpi_result_ring_write(struct lndpi_result_ring* ring, const struct lndpi_result_record* record)
+{
+    struct lndpi_result_record* slot = &ring->records[ring->write_seq & ring->mask];
+
+    /* Invalidate the slot, so readers don't take a half-written record */
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy((uint8_t*)slot + sizeof(slot->seq),
+        (const uint8_t*)record + sizeof(record->seq),
+        sizeof(*record) - sizeof(record->seq));
+
+    ++ring->write_seq;
+
+    __atomic_store_n(&slot->seq, ring->write_seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->write_seq, ring->write_seq, __ATOMIC_RELEASE);
+}
+
+/**
+ *  Fill record fields common for packet and flow records
+ */
+static void lndpi_result_record_fill(struct lndpi_result_record* record, struct lndpi_packet_flow* flow)
+{
+    memset(record, 0, sizeof(*record));
+
+    record->flow_id = flow->id;
+    record->src_addr = flow->src_addr.s_addr;
+    record->dst_addr = flow->dst_addr.s_addr;
+    record->src_port = flow->src_port;
+    record->dst_port = flow->dst_port;
+    record->master_protocol = flow->protocol.master_protocol;
+    record->app_protocol = flow->protocol.app_protocol;
+    record->category = flow->protocol.category;
+    record->processed_packets_num = flow->processed_packets_num;
+    record->ip_protocol = flow->ip_protocol;
+    record->protocol_was_guessed = flow->protocol_was_guessed;
+}
+
+enum lndpi_error lndpi_result_ring_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+) {
+    struct lndpi_result_record record;
+
+    lndpi_result_record_fill(&record, packet->lndpi_flow);
+
+    if (packet->direction != 1)
+    {
+        record.src_addr = packet->lndpi_flow->dst_addr.s_addr;
+        record.dst_addr = packet->lndpi_flow->src_addr.s_addr;
+        record.src_port = packet->lndpi_flow->dst_port;
+        record.dst_port = packet->lndpi_flow->src_port;
+    }
+
+    record.type = LNDPI_RESULT_RECORD_PACKET;
+    record.time_ms = packet->time_ms;
+    record.length = packet->length;
+    record.provisional = packet->provisional;
+
+    lndpi_result_ring_write((struct lndpi_result_ring*)parameter, &record);
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_result_ring_flow_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow,
+    void* parameter
+) {
+    struct lndpi_result_record record;
+
+    lndpi_result_record_fill(&record, flow);
+
+    record.type = LNDPI_RESULT_RECORD_FLOW;
+    record.time_ms = flow->last_packet_ms;
+
+    lndpi_result_ring_write((struct lndpi_result_ring*)parameter, &record);
+
+    return LNDPI_OK;
+}
+
+enum lndpi_error lndpi_result_ring_attach(struct lndpi_result_ring_reader* reader, const char* name)
+{
+    struct lndpi_result_ring_header header;
+    struct stat st;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+        return LNDPI_CANT_OPEN_RESULT_RING;
+
+    if (fstat(fd, &st) != 0
+        || (size_t)st.st_size < sizeof(header)
+        || pread(fd, &header, sizeof(header), 0) != sizeof(header))
+    {
+        close(fd);
+
+        return LNDPI_INVALID_RESULT_RING;
+    }
+
+    if (header.magic != LNDPI_RESULT_RING_MAGIC
+        || header.version != LNDPI_RESULT_RING_VERSION
+        || header.record_size != sizeof(struct lndpi_result_record)
+        || header.records_number == 0
+        || (header.records_number & (header.records_number - 1)) != 0
+        || (size_t)st.st_size < lndpi_result_ring_size(header.records_number))
+    {
+        close(fd);
+
+        return LNDPI_INVALID_RESULT_RING;
+    }
+
+    reader->map_size = lndpi_result_ring_size(header.records_number);
+    reader->header = (const struct lndpi_result_ring_header*)mmap(
+        NULL, reader->map_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (reader->header == MAP_FAILED)
+    {
+        reader->header = NULL;
+
+        return LNDPI_CANT_OPEN_RESULT_RING;
+    }
+
+    reader->records = (const struct lndpi_result_record*)(reader->header + 1);
+    reader->mask = header.records_number - 1;
+    reader->read_seq = __atomic_load_n(&reader->header->write_seq, __ATOMIC_ACQUIRE);
+    reader->lost_records = 0;
+
+    return LNDPI_OK;
+}
+
+uint8_t lndpi_result_ring_read(struct lndpi_result_ring_reader* reader, struct lndpi_result_record* record)
+{
+    for (;;)
+    {
+        uint64_t write_seq = __atomic_load_n(&reader->header->write_seq, __ATOMIC_ACQUIRE);
+
+        if (reader->read_seq >= write_seq)
+            return 0;
+
+        /* Skip records which were overwritten */
+        if (write_seq - reader->read_seq > (uint64_t)reader->mask + 1)
+        {
+            uint64_t oldest_seq = write_seq - reader->mask - 1;
+
+            reader->lost_records += oldest_seq - reader->read_seq;
+            reader->read_seq = oldest_seq;
+        }
+
+        const struct lndpi_result_record* slot = &reader->records[reader->read_seq & reader->mask];
+
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == reader->read_seq + 1)
+        {
+            memcpy(record, slot, sizeof(*record));
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            {
+                ++reader->read_seq;
+
+                return 1;
+            }
+        }
+
+        /* The slot is being rewritten for a newer record; skip it once the writer has published it */
+        if (__atomic_load_n(&reader->header->write_seq, __ATOMIC_ACQUIRE) - reader->read_seq
+            <= (uint64_t)reader->mask + 1)
+            return 0;
+    }
+}
+
+void lndpi_result_ring_detach(struct lndpi_result_ring_reader* reader)
+{
+    if (reader->header == NULL)
+        return;
+
+    munmap((void*)reader->header, reader->map_size);
+
+    reader->header = NULL;
+}
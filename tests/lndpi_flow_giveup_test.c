@@ -0,0 +1,252 @@
+/**
+ *  Flow give up test
+ *  Checks that flows which stay unknown are given up and expired after their timeout
+ *  even when none of their packets is left in the packet buffer, and that detection is given up
+ *  on max packets and timeout when packets are emitted unbuffered (built with LNDPI_NO_BUFFERING)
+ *
+ *  Usage: lndpi_flow_giveup_test
+ */
+#include "lndpi_packet.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <net/if_arp.h>
+
+/* Number of flows in every case */
+#define TEST_FLOWS_NUM 40
+
+/* Flow timeout in milliseconds */
+#define TEST_FLOW_TIMEOUT_MS 150
+
+static uint8_t s_frame[256] __attribute__((aligned(16)));
+static uint32_t s_verdicts;
+
+static enum lndpi_error test_packet_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_struct* packet_struct,
+    uint64_t timeout_ms,
+    uint32_t max_packets_to_process,
+    void* parameter
+) {
+    return LNDPI_OK;
+}
+
+static enum lndpi_error test_flow_verdict_callback(
+    struct ndpi_detection_module_struct* ndpi_struct,
+    struct lndpi_packet_flow* flow,
+    void* parameter
+) {
+    ++s_verdicts;
+
+    return LNDPI_OK;
+}
+
+/**
+ *  Process a UDP packet without payload from a client of flow_index to an unknown service
+ */
+static enum lndpi_error test_send(uint32_t flow_index)
+{
+    struct tpacket3_hdr* pkt = (struct tpacket3_hdr*)s_frame;
+    struct sockaddr_ll* sll = (struct sockaddr_ll*)(s_frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    struct timespec now;
+
+    memset(s_frame, 0, sizeof(s_frame));
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    sll->sll_hatype = ARPHRD_ETHER;
+
+    pkt->tp_sec = now.tv_sec;
+    pkt->tp_nsec = now.tv_nsec;
+    pkt->tp_mac = TPACKET3_HDRLEN + 2;
+    pkt->tp_net = pkt->tp_mac + 14;
+    pkt->tp_snaplen = pkt->tp_len = 14 + 28;
+
+    uint8_t* eth = s_frame + pkt->tp_mac;
+    eth[12] = 0x08;
+
+    uint8_t* ip = s_frame + pkt->tp_net;
+    ip[0] = 0x45;
+    ip[3] = 28;
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+
+    uint32_t client_addr = htonl(0x0a000001 + flow_index), server_addr = htonl(0xc0a80001);
+    uint16_t client_port = htons(20000 + flow_index), server_port = htons(5000);
+
+    memcpy(ip + 12, &client_addr, 4);
+    memcpy(ip + 16, &server_addr, 4);
+    memcpy(ip + 20, &client_port, 2);
+    memcpy(ip + 22, &server_port, 2);
+    ip[25] = 8;
+
+    return lndpi_process_packet(pkt);
+}
+
+static int test_init(uint32_t packet_buffer_size, uint32_t max_packets_to_process)
+{
+    s_verdicts = 0;
+
+    lndpi_set_flow_query(1);
+
+    if (lndpi_packet_lib_init(1024, max_packets_to_process, packet_buffer_size, TEST_FLOW_TIMEOUT_MS) != LNDPI_OK)
+        return 0;
+
+    lndpi_set_packet_callback_function(test_packet_callback, NULL);
+    lndpi_set_flow_verdict_callback_function(test_flow_verdict_callback, NULL);
+
+    return 1;
+}
+
+static int test_send_flows(uint32_t packets_per_flow)
+{
+    uint32_t i, j;
+
+    for (j = 0; j < packets_per_flow; ++j)
+        for (i = 0; i < TEST_FLOWS_NUM; ++i)
+            if (test_send(i) != LNDPI_OK)
+                return 0;
+
+    return 1;
+}
+
+/**
+ *  Wait until all flows time out and check that they were given up and expired
+ */
+static int test_expire(const char* name, uint32_t expected_verdicts)
+{
+    struct lndpi_flow_info infos[TEST_FLOWS_NUM];
+    uint32_t flows_num = 0;
+
+    usleep(TEST_FLOW_TIMEOUT_MS * 2 * 1000);
+
+    int ok = lndpi_poll() == LNDPI_OK
+        && (flows_num = lndpi_query_flows(infos, TEST_FLOWS_NUM)) == 0
+        && s_verdicts == expected_verdicts;
+
+    printf("%s: %s (%u flows left, %u verdicts of %u)\n",
+        name, ok ? "ok" : "FAILED", flows_num, s_verdicts, expected_verdicts);
+
+    lndpi_packet_lib_exit();
+
+    return ok;
+}
+
+#ifdef LNDPI_NO_BUFFERING
+/**
+ *  Check that every flow is still alive with a final verdict
+ */
+static int test_finished(const char* name)
+{
+    struct lndpi_flow_info infos[TEST_FLOWS_NUM];
+    uint32_t flows_num, finished_num = 0, i;
+
+    flows_num = lndpi_query_flows(infos, TEST_FLOWS_NUM);
+
+    for (i = 0; i < flows_num; ++i)
+        finished_num += infos[i].detection_finished;
+
+    int ok = flows_num == TEST_FLOWS_NUM
+        && finished_num == TEST_FLOWS_NUM
+        && s_verdicts == TEST_FLOWS_NUM;
+
+    printf("%s: %s (%u flows, %u finished, %u verdicts)\n",
+        name, ok ? "ok" : "FAILED", flows_num, finished_num, s_verdicts);
+
+    lndpi_packet_lib_exit();
+    lndpi_set_housekeeping_interval(1, 0);
+
+    return ok;
+}
+#endif
+
+/**
+ *  Packets released by the hold time leave unknown flows without buffered packets
+ */
+static int test_hold_time(void)
+{
+    lndpi_set_max_packet_hold_ms(10);
+
+    if (!test_init(1024, 100) || !test_send_flows(3))
+        return 0;
+
+    usleep(50 * 1000);
+
+    if (lndpi_poll() != LNDPI_OK)
+        return 0;
+
+    int ok = test_expire("hold time", TEST_FLOWS_NUM);
+
+    lndpi_set_max_packet_hold_ms(0);
+
+    return ok;
+}
+
+#ifndef LNDPI_NO_BUFFERING
+/**
+ *  Packets emitted unclassified from a full packet buffer are never buffered
+ *  Only flows without buffered packets are emitted so, and only they get verdicts
+ */
+static int test_emit_unclassified(void)
+{
+    lndpi_set_packet_buffer_policy(LNDPI_PACKET_BUFFER_POLICY_EMIT_UNCLASSIFIED);
+
+    if (!test_init(8, 100) || !test_send_flows(1))
+        return 0;
+
+    int ok = test_expire("emit unclassified", TEST_FLOWS_NUM - 8);
+
+    lndpi_set_packet_buffer_policy(LNDPI_PACKET_BUFFER_POLICY_ERROR);
+
+    return ok;
+}
+#else
+/**
+ *  Detection is given up once a flow has more processed packets than allowed
+ *  Housekeeping is left to lndpi_poll() so that only packet processing gives flows up
+ */
+static int test_max_packets(void)
+{
+    lndpi_set_housekeeping_interval(0, 0);
+
+    if (!test_init(1024, 3) || !test_send_flows(5))
+        return 0;
+
+    return test_finished("max packets");
+}
+
+/**
+ *  Detection is given up once a packet arrives after the flow timed out
+ */
+static int test_timeout(void)
+{
+    lndpi_set_housekeeping_interval(0, 0);
+
+    if (!test_init(1024, 100) || !test_send_flows(1))
+        return 0;
+
+    usleep(TEST_FLOW_TIMEOUT_MS * 2 * 1000);
+
+    if (!test_send_flows(1))
+        return 0;
+
+    return test_finished("timeout");
+}
+#endif
+
+int main(void)
+{
+    int ok = 1;
+
+    ok &= test_hold_time();
+#ifndef LNDPI_NO_BUFFERING
+    ok &= test_emit_unclassified();
+#else
+    ok &= test_max_packets();
+    ok &= test_timeout();
+#endif
+
+    return !ok;
+}